@@ -0,0 +1,295 @@
+// Block buffer cache that sits between the simple file system and the disk emulator.
+// Blocks are held in a fixed number of frames (sized from a memory budget) that are
+// replaced with the CLOCK algorithm. Writes either go through to the disk right away
+// or stay dirty in memory until they are evicted or flushed (write-back).
+// Each disk has its own cache. Every call holds the lock of the cache, except while large
+// requests move data to or from the disk (the file system keeps two threads from writing
+// the same block at once).
+
+/* includes */
+#include "block_cache.h"
+#include "disk_emu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* maximum number of blocks written by a single flush request */
+#define FLUSH_BATCH                        256
+
+/* dirty frame, sorted by address when flushing */
+typedef struct {
+    int address; // address of the block held by the frame
+    int frame; // index of the frame
+} flush_entry;
+
+/* cache in front of a disk */
+struct block_cache {
+    /* cache geometry */
+    disk_struct *disk; // disk the blocks come from
+    int block_size; // size of a block (in bytes)
+    int num_of_frames; // number of blocks the cache can hold (0 = every request goes to the disk)
+    int num_of_buckets; // number of buckets in the hash table (power of two)
+    int write_mode; // WRITE_THROUGH or WRITE_BACK
+
+    /* frames */
+    char *frames; // content of the cached blocks
+    int *frame_block; // address of the block held by each frame, -1 if the frame is empty
+    char *frame_dirty; // 1 = the frame is newer than the disk, 0 = the disk is up to date
+    char *frame_referenced; // reference bit of the CLOCK algorithm
+    int *frame_next; // next frame in the same bucket, -1 at the end of the chain
+    int *bucket_heads; // first frame of each bucket, -1 if the bucket is empty
+    int clock_hand; // next frame the CLOCK algorithm looks at
+
+    /* flushing */
+    flush_entry *flush_order; // dirty frames sorted by address
+    struct iovec *flush_vector; // frames of consecutive dirty blocks, written by a single request
+
+    /* statistics */
+    cache_stats stats; // hit/miss counters
+
+    /* lock over the frames, the hash table and the counters */
+    pthread_mutex_t lock;
+};
+
+/* ( helper ) release the frames of a cache, every request then goes to the disk */
+static void free_frames(block_cache *cache){
+    free(cache->frames);
+    free(cache->frame_block);
+    free(cache->frame_dirty);
+    free(cache->frame_referenced);
+    free(cache->frame_next);
+    free(cache->bucket_heads);
+    free(cache->flush_order);
+    free(cache->flush_vector);
+    cache->frames = cache->frame_dirty = cache->frame_referenced = NULL;
+    cache->frame_block = cache->frame_next = cache->bucket_heads = NULL;
+    cache->flush_order = NULL;
+    cache->flush_vector = NULL;
+    cache->num_of_frames = 0;
+}
+
+/* ( helper ) finds the frame holding the block at the given address, -1 if it is not cached */
+static int lookup_frame(block_cache *cache, int address){
+    for ( int frame = cache->bucket_heads[address & (cache->num_of_buckets-1)]; frame != -1; frame = cache->frame_next[frame] ) {
+        if ( cache->frame_block[frame] == address ) return frame;
+    }
+    return -1;
+}
+
+/* ( helper ) remove a frame from the hash table and mark it empty */
+static void unlink_frame(block_cache *cache, int frame){
+    // find the link that points to this frame, and skip over it
+    int *link = &cache->bucket_heads[cache->frame_block[frame] & (cache->num_of_buckets-1)];
+    while ( *link != frame ) link = &cache->frame_next[*link];
+    *link = cache->frame_next[frame];
+    // the frame is now empty
+    cache->frame_block[frame] = -1;
+    cache->frame_dirty[frame] = 0;
+}
+
+/* ( helper ) pick a frame for a new block (CLOCK), writing back its previous content if it is dirty */
+static int claim_frame(block_cache *cache){
+    while ( 1 ) {
+        int frame = cache->clock_hand;
+        cache->clock_hand = ( cache->clock_hand + 1 ) % cache->num_of_frames;
+        // empty frames are used right away
+        if ( cache->frame_block[frame] == -1 ) return frame;
+        // recently used frames get a second chance
+        if ( cache->frame_referenced[frame] ) {
+            cache->frame_referenced[frame] = 0;
+            continue;
+        }
+        // otherwise evict the block it holds
+        if ( cache->frame_dirty[frame] ) {
+            write_blocks(cache->disk, cache->frame_block[frame], 1, cache->frames + (long)frame*cache->block_size);
+            cache->stats.write_backs++;
+        }
+        unlink_frame(cache, frame);
+        return frame;
+    }
+}
+
+/* ( helper ) copy a block into the cache */
+static void cache_block(block_cache *cache, int address, const void *data, int dirty){
+    // reuse the frame if the block is already cached, otherwise claim one
+    int frame = lookup_frame(cache, address);
+    if ( frame == -1 ) {
+        frame = claim_frame(cache);
+        cache->frame_block[frame] = address;
+        cache->frame_next[frame] = cache->bucket_heads[address & (cache->num_of_buckets-1)];
+        cache->bucket_heads[address & (cache->num_of_buckets-1)] = frame;
+    }
+    memcpy(cache->frames + (long)frame*cache->block_size, data, cache->block_size);
+    cache->frame_dirty[frame] = dirty;
+    cache->frame_referenced[frame] = 1;
+}
+
+/* ( helper ) compare two dirty frames by the address of their block (used to sort them) */
+static int compare_frames(const void *a, const void *b){
+    return ((const flush_entry *)a)->address - ((const flush_entry *)b)->address;
+}
+
+/* create an empty cache of at most budget bytes in front of the given disk, NULL if it can not be allocated
+ * (if the frames can not be allocated, every request goes to the disk) */
+block_cache *cache_init(disk_struct *disk, int size_of_block, int budget, int mode){
+    block_cache *cache = calloc(1, sizeof(block_cache));
+    if ( !cache ) {
+        fprintf(stderr, "Error, could not allocate a cache.\n");
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    // geometry
+    cache->disk = disk;
+    cache->block_size = size_of_block;
+    cache->num_of_frames = budget / size_of_block;
+    cache->write_mode = mode;
+    for ( cache->num_of_buckets = 1; cache->num_of_buckets < cache->num_of_frames; cache->num_of_buckets <<= 1 );
+    // a budget smaller than a block disables the cache
+    if ( !cache->num_of_frames ) return cache;
+    // allocate the frames
+    cache->frames = malloc((long)cache->num_of_frames * cache->block_size);
+    cache->frame_block = malloc(cache->num_of_frames * sizeof(int));
+    cache->frame_dirty = calloc(cache->num_of_frames, 1);
+    cache->frame_referenced = calloc(cache->num_of_frames, 1);
+    cache->frame_next = malloc(cache->num_of_frames * sizeof(int));
+    cache->bucket_heads = malloc(cache->num_of_buckets * sizeof(int));
+    cache->flush_order = malloc(cache->num_of_frames * sizeof(flush_entry));
+    cache->flush_vector = malloc(FLUSH_BATCH * sizeof(struct iovec));
+    if ( !cache->frames || !cache->frame_block || !cache->frame_dirty || !cache->frame_referenced || !cache->frame_next || !cache->bucket_heads || !cache->flush_order || !cache->flush_vector ) {
+        fprintf(stderr, "Error, could not allocate a cache of %d bytes.\n", budget);
+        free_frames(cache);
+        return cache;
+    }
+    // every frame and bucket starts empty
+    for ( int i=0; i < cache->num_of_frames; i++ ) cache->frame_block[i] = cache->frame_next[i] = -1;
+    for ( int i=0; i < cache->num_of_buckets; i++ ) cache->bucket_heads[i] = -1;
+    return cache;
+}
+
+/* release the cache (dirty blocks are dropped, flush them first) */
+void cache_destroy(block_cache *cache){
+    if ( !cache ) return;
+    free_frames(cache);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/* read a series of blocks, from memory when they are cached and from the disk otherwise */
+int cache_read_blocks(block_cache *cache, int start_address, int nblocks, void *buffer){
+    pthread_mutex_lock(&cache->lock);
+    // large requests are not kept, they would only push everything else out
+    int keep = nblocks <= cache->num_of_frames / CACHE_BYPASS_FRACTION;
+    int i = 0;
+    while ( i < nblocks ) {
+        // serve the block from memory if we can
+        int frame = cache->num_of_frames ? lookup_frame(cache, start_address + i) : -1;
+        if ( frame != -1 ) {
+            memcpy((char *)buffer + (long)i*cache->block_size, cache->frames + (long)frame*cache->block_size, cache->block_size);
+            cache->frame_referenced[frame] = 1;
+            cache->stats.hits++;
+            i++;
+            continue;
+        }
+        // otherwise read the whole run of missing blocks at once (other threads use the cache meanwhile)
+        int end = i + 1;
+        while ( end < nblocks && ( !cache->num_of_frames || lookup_frame(cache, start_address + end) == -1 ) ) end++;
+        pthread_mutex_unlock(&cache->lock);
+        if ( read_blocks(cache->disk, start_address + i, end - i, (char *)buffer + (long)i*cache->block_size) < 0 ) return -1;
+        pthread_mutex_lock(&cache->lock);
+        cache->stats.misses += end - i;
+        // and remember them, unless another thread cached them meanwhile (its copy is at least as recent)
+        for ( int j=i; keep && j < end; j++ ) {
+            if ( lookup_frame(cache, start_address + j) == -1 ) cache_block(cache, start_address + j, (char *)buffer + (long)j*cache->block_size, 0);
+        }
+        i = end;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return nblocks;
+}
+
+/* write a series of blocks (kept in memory in write-back mode) */
+int cache_write_blocks(block_cache *cache, int start_address, int nblocks, void *buffer){
+    pthread_mutex_lock(&cache->lock);
+    // large requests go straight to the disk, only the copies we already hold are refreshed
+    // (first, so an older dirty copy is not written over them once the lock is released)
+    if ( nblocks > cache->num_of_frames / CACHE_BYPASS_FRACTION ) {
+        for ( int i=0; cache->num_of_frames && i < nblocks; i++ ) {
+            int frame = lookup_frame(cache, start_address + i);
+            if ( frame != -1 ) cache_block(cache, start_address + i, (char *)buffer + (long)i*cache->block_size, 0);
+        }
+        pthread_mutex_unlock(&cache->lock);
+        if ( write_blocks(cache->disk, start_address, nblocks, buffer) < 0 ) return -1;
+        return nblocks;
+    }
+    // copy the blocks into the cache
+    for ( int i=0; i < nblocks; i++ ) cache_block(cache, start_address + i, (char *)buffer + (long)i*cache->block_size, cache->write_mode == WRITE_BACK);
+    pthread_mutex_unlock(&cache->lock);
+    // in write-through mode, the disk is updated right away
+    if ( cache->write_mode == WRITE_THROUGH && write_blocks(cache->disk, start_address, nblocks, buffer) < 0 ) return -1;
+    return nblocks;
+}
+
+/* write every dirty block to the disk (consecutive blocks are written together) */
+int cache_flush(block_cache *cache){
+    pthread_mutex_lock(&cache->lock);
+    // gather the dirty frames, in disk order
+    int count = 0;
+    for ( int i=0; i < cache->num_of_frames; i++ ) if ( cache->frame_dirty[i] ) cache->flush_order[count++] = (flush_entry){ cache->frame_block[i], i };
+    qsort(cache->flush_order, count, sizeof(flush_entry), compare_frames);
+    // write them out in batches of consecutive blocks, straight from their frames
+    int i = 0;
+    while ( i < count ) {
+        int end = i + 1;
+        while ( end < count && end - i < FLUSH_BATCH && cache->flush_order[end].address == cache->flush_order[end-1].address + 1 ) end++;
+        for ( int j=i; j < end; j++ ) {
+            cache->flush_vector[j-i].iov_base = cache->frames + (long)cache->flush_order[j].frame*cache->block_size;
+            cache->flush_vector[j-i].iov_len = cache->block_size;
+            cache->frame_dirty[cache->flush_order[j].frame] = 0;
+        }
+        if ( writev_blocks(cache->disk, cache->flush_order[i].address, end - i, cache->flush_vector, end - i) < 0 ) {
+            pthread_mutex_unlock(&cache->lock);
+            return -1;
+        }
+        cache->stats.write_backs += end - i;
+        i = end;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+/* write the dirty cached copies of the given blocks to the disk (so the disk can be read or written around the cache) */
+int cache_write_back(block_cache *cache, int start_address, int nblocks){
+    pthread_mutex_lock(&cache->lock);
+    for ( int i=0; cache->num_of_frames && i < nblocks; i++ ) {
+        int frame = lookup_frame(cache, start_address + i);
+        if ( frame == -1 || !cache->frame_dirty[frame] ) continue;
+        if ( write_blocks(cache->disk, start_address + i, 1, cache->frames + (long)frame*cache->block_size) < 0 ) {
+            pthread_mutex_unlock(&cache->lock);
+            return -1;
+        }
+        cache->frame_dirty[frame] = 0;
+        cache->stats.write_backs++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+/* forget the given blocks without writing them (their content no longer matters) */
+void cache_invalidate(block_cache *cache, int start_address, int nblocks){
+    pthread_mutex_lock(&cache->lock);
+    for ( int i=0; cache->num_of_frames && i < nblocks; i++ ) {
+        int frame = lookup_frame(cache, start_address + i);
+        if ( frame != -1 ) unlink_frame(cache, frame);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* get the hit/miss counters (they start from 0 with the cache) */
+cache_stats cache_get_stats(block_cache *cache){
+    pthread_mutex_lock(&cache->lock);
+    cache_stats copy = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+    return copy;
+}
@@ -0,0 +1,34 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "disk_emu.h"
+
+/* write policies */
+#define WRITE_THROUGH                      0                                // writes reach the disk before returning
+#define WRITE_BACK                         1                                // writes stay in memory until evicted or flushed
+
+/* defaults */
+#define CACHE_SIZE                         ( 4 * 1024 * 1024 )              // default memory budget of the cache (in bytes)
+#define CACHE_BYPASS_FRACTION              4                                // requests larger than 1/4 of the cache go straight to the disk
+
+/* cache statistics */
+typedef struct {
+    long hits; // blocks served from memory
+    long misses; // blocks that had to be read from the disk
+    long write_backs; // dirty blocks written to the disk (on eviction or flush)
+} cache_stats;
+
+/* cache in front of a disk (its frames are private to block_cache.c) */
+typedef struct block_cache block_cache;
+
+/* API functions */
+block_cache *cache_init(disk_struct *disk, int block_size, int budget, int mode);
+void cache_destroy(block_cache *cache);
+int cache_read_blocks(block_cache *cache, int start_address, int nblocks, void *buffer);
+int cache_write_blocks(block_cache *cache, int start_address, int nblocks, void *buffer);
+int cache_flush(block_cache *cache);
+int cache_write_back(block_cache *cache, int start_address, int nblocks);
+void cache_invalidate(block_cache *cache, int start_address, int nblocks);
+cache_stats cache_get_stats(block_cache *cache);
+
+#endif
@@ -1,23 +1,26 @@
+#define _GNU_SOURCE /*fallocate*/
 #include <stdio.h>
-#include <stdlib.h> 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include "disk_emu.h"
 
-FILE* fp = NULL;
-double L, p;
-double r;
-int BLOCK_SIZE, MAX_BLOCK, MAX_RETRY;
+#ifndef IOV_MAX
+#define IOV_MAX 1024 /*Number of buffers a single vectored call accepts*/
+#endif
 
 /*----------------------------------------------------------*/
 /*Close the disk file filled when you don't need it anymore. */
 /*----------------------------------------------------------*/
-int close_disk()
+int close_disk(disk_struct *disk)
 {
-    if(NULL != fp)
+    if(-1 != disk->fd)
     {
-        fclose(fp);
+        close(disk->fd);
+        disk->fd = -1;
     }
     return 0;
 }
@@ -25,46 +28,41 @@ int close_disk()
 /*---------------------------------------*/
 /*Initializes a disk file filled with 0's*/
 /*---------------------------------------*/
-int init_fresh_disk(char *filename, int block_size, int num_blocks)
+int init_fresh_disk(disk_struct *disk, const char *filename, int block_size, int num_blocks)
 {
-    int i, j;
+    disk->block_size = block_size;
+    disk->max_block = num_blocks;
 
-    BLOCK_SIZE = block_size;
-    MAX_BLOCK = num_blocks;
-    
-    /*Initializes the random number generator*/
-    srand((unsigned int)(time( 0 )) );
     /*Creates a new file*/
-    fp = fopen (filename, "w+b");
+    disk->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
 
-    if (fp == NULL)
+    if (disk->fd == -1)
     {
         printf("Could not create new disk file %s\n\n", filename);
         return -1;
     }
-    
-    /*Fills the file with 0's to its given size*/
-    for (i = 0; i < MAX_BLOCK; i++)
+
+    /*Extends the file to its given size, the blocks read as 0's until they are written (sparse file)*/
+    if (ftruncate(disk->fd, (off_t)disk->max_block * disk->block_size) == -1)
     {
-        for (j = 0; j < BLOCK_SIZE; j++)
-        {
-            fputc(0, fp);
-        }
+        printf("Could not resize disk file %s\n\n", filename);
+        close_disk(disk);
+        return -1;
     }
     return 0;
 }
 /*----------------------------*/
 /*Initializes an existing disk*/
 /*----------------------------*/
-int init_disk(char *filename, int block_size, int num_blocks)
+int init_disk(disk_struct *disk, const char *filename, int block_size, int num_blocks)
 {
-    BLOCK_SIZE = block_size;
-    MAX_BLOCK = num_blocks;
-    
+    disk->block_size = block_size;
+    disk->max_block = num_blocks;
+
     /*Opens a file*/
-    fp = fopen (filename, "r+b");
+    disk->fd = open(filename, O_RDWR);
 
-    if (fp == NULL)
+    if (disk->fd == -1)
     {
         printf("Could not open %s\n\n", filename);
         return -1;
@@ -73,70 +71,126 @@ int init_disk(char *filename, int block_size, int num_blocks)
 }
 
 /*-------------------------------------------------------------------*/
-/*Reads a series of blocks from the disk into the buffer             */
+/*Moves nblocks between the disk and the buffers with positional     */
+/*vectored I/O, resuming after short transfers                       */
 /*-------------------------------------------------------------------*/
-int read_blocks(int start_address, int nblocks, void *buffer)
+static int transfer_blocks(disk_struct *disk, int writing, int start_address, int nblocks, const struct iovec *iov, int iovcnt)
 {
-    int i, s;
-    s = 0;
-
-    /*Sets up a temporary buffer*/
-    void* blockRead = (void*) malloc(BLOCK_SIZE);
-
     /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
+    if (start_address < 0 || start_address + nblocks > disk->max_block)
     {
         printf("out of bound error %d\n", start_address);
         return -1;
     }
 
-    /*Goto the data requested from the disk*/
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
+    /*Local copy of the buffers, advanced as the data moves*/
+    struct iovec vec[iovcnt];
+    struct iovec *current = vec;
+    memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+
+    off_t offset = (off_t)start_address * disk->block_size;
+    size_t remaining = (size_t)nblocks * disk->block_size;
 
-    /*For every block requested*/
-    for (i = 0; i < nblocks; ++i)
+    while (remaining > 0 && iovcnt > 0)
     {
-        s++;
-        fread(blockRead, BLOCK_SIZE, 1, fp);
-        memcpy((char *)buffer+(i*BLOCK_SIZE), blockRead, BLOCK_SIZE);  
+        /*A single system call moves as many buffers as the kernel accepts*/
+        ssize_t n = writing ? pwritev(disk->fd, current, iovcnt < IOV_MAX ? iovcnt : IOV_MAX, offset)
+                            : preadv(disk->fd, current, iovcnt < IOV_MAX ? iovcnt : IOV_MAX, offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            printf("could not %s block %d\n", writing ? "write" : "read", (int)(offset / disk->block_size));
+            return -1;
+        }
+        offset += n;
+        remaining -= n;
+
+        /*Skips over the buffers that were filled, and into the one that was cut short*/
+        while (iovcnt > 0 && (size_t)n >= current->iov_len)
+        {
+            n -= current->iov_len;
+            current++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            current->iov_base = (char *)current->iov_base + n;
+            current->iov_len -= n;
+        }
     }
+    return nblocks;
+}
 
-    free(blockRead);
-    return s;
+/*-------------------------------------------------------------------*/
+/*Reads a series of blocks from the disk into the buffer             */
+/*-------------------------------------------------------------------*/
+int read_blocks(disk_struct *disk, int start_address, int nblocks, void *buffer)
+{
+    struct iovec iov = { buffer, (size_t)nblocks * disk->block_size };
+    return transfer_blocks(disk, 0, start_address, nblocks, &iov, 1);
 }
 
 /*------------------------------------------------------------------*/
 /* Writes a series of blocks to the disk from the buffer             */
 /*------------------------------------------------------------------*/
-int write_blocks(int start_address, int nblocks, void *buffer)
+int write_blocks(disk_struct *disk, int start_address, int nblocks, void *buffer)
 {
-    int i, s;
-    s = 0;
+    struct iovec iov = { buffer, (size_t)nblocks * disk->block_size };
+    return transfer_blocks(disk, 1, start_address, nblocks, &iov, 1);
+}
 
-    void* blockWrite = (void*) malloc(BLOCK_SIZE);
+/*-------------------------------------------------------------------*/
+/*Reads a series of consecutive blocks into scattered buffers        */
+/*-------------------------------------------------------------------*/
+int readv_blocks(disk_struct *disk, int start_address, int nblocks, const struct iovec *iov, int iovcnt)
+{
+    return transfer_blocks(disk, 0, start_address, nblocks, iov, iovcnt);
+}
 
-    /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
+/*-------------------------------------------------------------------*/
+/*Writes a series of consecutive blocks from scattered buffers       */
+/*-------------------------------------------------------------------*/
+int writev_blocks(disk_struct *disk, int start_address, int nblocks, const struct iovec *iov, int iovcnt)
+{
+    return transfer_blocks(disk, 1, start_address, nblocks, iov, iovcnt);
+}
+
+/*-------------------------------------------------------------------*/
+/*Tells the disk a series of blocks no longer holds data: they read  */
+/*back as 0's and the space goes back to the host where supported    */
+/*(otherwise they keep their old content, which is just as valid)    */
+/*-------------------------------------------------------------------*/
+int discard_blocks(disk_struct *disk, int start_address, int nblocks)
+{
+    if (start_address < 0 || start_address + nblocks > disk->max_block)
     {
-        printf("out of bound error\n");
+        printf("out of bound error %d\n", start_address);
         return -1;
     }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(disk->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)start_address * disk->block_size, (off_t)nblocks * disk->block_size) == 0)
+        return nblocks;
+#endif
+    return 0;
+}
 
-    /*Goto where the data is to be written on the disk*/        
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
-
-    /*For every block requested*/        
-    for (i = 0; i < nblocks; ++i)
-    {
-        /*Pause until the latency duration is elapsed*/
-        usleep(L);
-
-        memcpy(blockWrite, (char *)buffer+(i*BLOCK_SIZE), BLOCK_SIZE);
+/*-------------------------------------------------------------------*/
+/*Makes every write so far durable (writes are no longer flushed one */
+/*block at a time)                                                   */
+/*-------------------------------------------------------------------*/
+int sync_disk(disk_struct *disk)
+{
+    if (-1 == disk->fd)
+        return 0;
+    return fdatasync(disk->fd);
+}
 
-        fwrite(blockWrite, BLOCK_SIZE, 1, fp);
-        fflush(fp);
-        s++;
-    }
-    free(blockWrite);
-    return s;
+/*-------------------------------------------------------------------*/
+/*Gives the file descriptor of the disk file, so data can be moved   */
+/*in and out of it without going through a buffer (-1 if closed)     */
+/*-------------------------------------------------------------------*/
+int disk_fd(disk_struct *disk)
+{
+    return disk->fd;
 }
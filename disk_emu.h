@@ -1,5 +1,24 @@
-int init_fresh_disk(char *filename, int block_size, int num_blocks);
-int init_disk(char *filename, int block_size, int num_blocks);
-int read_blocks(int start_address, int nblocks, void *buffer);
-int write_blocks(int start_address, int nblocks, void *buffer);
-int close_disk();
+#ifndef DISK_EMU_H
+#define DISK_EMU_H
+
+#include <sys/uio.h>
+
+/*An open disk file, and its geometry*/
+typedef struct {
+    int fd;         /*file descriptor of the disk file, -1 if closed*/
+    int block_size; /*size of a block (in bytes)*/
+    int max_block;  /*number of blocks of the disk*/
+} disk_struct;
+
+int init_fresh_disk(disk_struct *disk, const char *filename, int block_size, int num_blocks);
+int init_disk(disk_struct *disk, const char *filename, int block_size, int num_blocks);
+int read_blocks(disk_struct *disk, int start_address, int nblocks, void *buffer);
+int write_blocks(disk_struct *disk, int start_address, int nblocks, void *buffer);
+int readv_blocks(disk_struct *disk, int start_address, int nblocks, const struct iovec *iov, int iovcnt);
+int writev_blocks(disk_struct *disk, int start_address, int nblocks, const struct iovec *iov, int iovcnt);
+int discard_blocks(disk_struct *disk, int start_address, int nblocks);
+int sync_disk(disk_struct *disk);
+int disk_fd(disk_struct *disk);
+int close_disk(disk_struct *disk);
+
+#endif
@@ -0,0 +1,466 @@
+#define FUSE_USE_VERSION 30
+
+#include <fuse_lowlevel.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include "disk_emu.h"
+#include "sfs_api.h"
+
+/* the kernel numbers the root 1 (FUSE_ROOT_ID), the SFS root is i-Node 0 */
+#define TO_INODE(ino)                      ( (int)(ino) - 1 )
+#define TO_INO(i_node)                     ( (fuse_ino_t)(i_node) + 1 )
+
+/* how long the kernel may keep names and attributes without asking again (in seconds),
+ * nothing else changes the image while it is mounted */
+#define ENTRY_TIMEOUT                      60.0
+#define ATTR_TIMEOUT                       60.0
+
+/* number of files fetched from the directory at once */
+#define READDIR_BATCH                      64
+
+/* the volume being served (geometry macros read it) */
+static sfs_context *fs;
+
+/* ( helper ) build the SFS name of a file of the root directory, -1 if it is too long */
+static int make_filename(char *filename, const char *name)
+{
+    if (strlen(name) + 1 > MAX_FILENAME + MAX_FILE_EXTENSION + 1)
+        return -1;
+
+    /* the path based wrappers store the names with their leading slash */
+    filename[0] = '/';
+    strcpy(filename + 1, name);
+    return 0;
+}
+
+/* ( helper ) fill the attributes of an i-Node, -1 if no file has this number */
+static int fill_stat(int i_node, struct stat *stbuf)
+{
+    int size;
+
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = TO_INO(i_node);
+
+    if (i_node == 0) {
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+    } else if ((size = sfs_getinode(i_node, NULL)) != -1) {
+        stbuf->st_mode = S_IFREG | 0666;
+        stbuf->st_nlink = 1;
+        stbuf->st_size = size;
+    } else
+        return -1;
+
+    return 0;
+}
+
+/* ( helper ) describe extents of a file as ranges of the disk file, so libfuse can splice them */
+static struct fuse_bufvec *make_bufvec(const file_extent *extents, int count)
+{
+    struct fuse_bufvec *bufv;
+    int i;
+
+    bufv = calloc(1, sizeof(struct fuse_bufvec) + count * sizeof(struct fuse_buf));
+    if (bufv == NULL)
+        return NULL;
+
+    bufv->count = count;
+    for (i = 0; i < count; i++) {
+        bufv->buf[i].size = extents[i].length;
+        bufv->buf[i].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        bufv->buf[i].fd = disk_fd(&fs->disk);
+        bufv->buf[i].pos = extents[i].disk_offset;
+    }
+    return bufv;
+}
+
+/* ( helper ) describe the memory buffers of a bufvec as a vector, so they are written in one batch
+ * return the number of buffers, -1 if part of the data is in a file (a pipe when splicing) */
+static int make_iovec(const struct fuse_bufvec *bufv, struct iovec *iov)
+{
+    size_t i;
+
+    for (i = bufv->idx; i < bufv->count; i++) {
+        if (bufv->buf[i].flags & FUSE_BUF_IS_FD)
+            return -1;
+        iov[i - bufv->idx].iov_base = (char *)bufv->buf[i].mem + (i == bufv->idx ? bufv->off : 0);
+        iov[i - bufv->idx].iov_len = bufv->buf[i].size - (i == bufv->idx ? bufv->off : 0);
+    }
+    return bufv->count - bufv->idx;
+}
+
+/* ( helper ) answer a lookup or a create with the entry of an i-Node */
+static void fill_entry(int i_node, struct fuse_entry_param *e)
+{
+    memset(e, 0, sizeof(struct fuse_entry_param));
+    e->ino = TO_INO(i_node);
+    e->attr_timeout = ATTR_TIMEOUT;
+    e->entry_timeout = ENTRY_TIMEOUT;
+    fill_stat(i_node, &e->attr);
+}
+
+static void fuse_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    /* accept writes larger than a page, up to what the channel allows,
+     * and move the data between the disk file and the kernel without copying it */
+    conn->want |= FUSE_CAP_BIG_WRITES | FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE;
+}
+
+static void fuse_ll_destroy(void *userdata)
+{
+    sfs_sync();
+}
+
+static void fuse_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    char filename[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
+    struct fuse_entry_param e;
+    int i_node;
+
+    if (TO_INODE(parent) != 0)
+        fuse_reply_err(req, ENOENT);
+    else if (make_filename(filename, name) == -1)
+        fuse_reply_err(req, ENAMETOOLONG);
+    else if ((i_node = sfs_lookup(filename)) == -1)
+        fuse_reply_err(req, ENOENT);
+    else {
+        fill_entry(i_node, &e);
+        fuse_reply_entry(req, &e);
+    }
+}
+
+static void fuse_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct stat stbuf;
+
+    if (fill_stat(TO_INODE(ino), &stbuf) == -1)
+        fuse_reply_err(req, ENOENT);
+    else
+        fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+}
+
+static void fuse_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+        int to_set, struct fuse_file_info *fi)
+{
+    struct stat stbuf;
+    int fd, res;
+
+    if (fill_stat(TO_INODE(ino), &stbuf) == -1) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    /* only the size can change, the other attributes are fixed */
+    if ((to_set & FUSE_SET_ATTR_SIZE) && attr->st_size != stbuf.st_size) {
+        /* the size must fit the SFS sizes before it is narrowed */
+        if (attr->st_size > MAX_FILE_SIZE) {
+            fuse_reply_err(req, EFBIG);
+            return;
+        }
+
+        /* files truncated by path are opened just for the call */
+        fd = fi ? (int)fi->fh : sfs_fopeninode(TO_INODE(ino));
+        if (fd == -1) {
+            fuse_reply_err(req, ENFILE);
+            return;
+        }
+
+        res = sfs_ftruncate(fd, attr->st_size);
+        if (fi == NULL)
+            sfs_fclose(fd);
+        if (res == -1) {
+            fuse_reply_err(req, ENOSPC);
+            return;
+        }
+        fill_stat(TO_INODE(ino), &stbuf);
+    }
+
+    fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
+}
+
+/* ( helper ) add an entry to a directory listing, -1 if the buffer is full */
+static int add_direntry(fuse_req_t req, char *buf, size_t size, size_t *used,
+        const char *name, const struct stat *stbuf, off_t off)
+{
+    size_t len = fuse_add_direntry(req, buf + *used, size - *used, name, stbuf, off);
+
+    if (len > size - *used)
+        return -1;
+
+    *used += len;
+    return 0;
+}
+
+static void fuse_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+        off_t off, struct fuse_file_info *fi)
+{
+    readdir_entry entries[READDIR_BATCH];
+    struct stat stbuf;
+    char *buf;
+    size_t used = 0;
+    int cookie, count, full, i;
+
+    if (TO_INODE(ino) != 0) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    buf = malloc(size);
+    if (buf == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    /* "." and ".." come first, then the file with i-Node n is at offset n+2 (the offset of an entry is where the next one starts) */
+    memset(&stbuf, 0, sizeof(struct stat));
+    stbuf.st_ino = FUSE_ROOT_ID;
+    stbuf.st_mode = S_IFDIR;
+    full = (off < 1 && add_direntry(req, buf, size, &used, ".", &stbuf, 1) == -1)
+        || (off < 2 && add_direntry(req, buf, size, &used, "..", &stbuf, 2) == -1);
+
+    /* list the files in batches, and stop once the buffer is full (the kernel asks again from there) */
+    cookie = MAX(off - 1, 1);
+    while (!full && (count = sfs_readdir(cookie, entries, READDIR_BATCH)) > 0) {
+        for (i = 0; i < count && !full; i++) {
+            stbuf.st_ino = TO_INO(entries[i].i_node_number);
+            stbuf.st_mode = S_IFREG;
+            full = add_direntry(req, buf, size, &used, &entries[i].filename[1], &stbuf,
+                    entries[i].i_node_number + 2) == -1;
+        }
+        cookie = entries[count - 1].i_node_number + 1;
+    }
+
+    fuse_reply_buf(req, buf, used);
+    free(buf);
+}
+
+static void fuse_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int fd;
+
+    if (TO_INODE(ino) == 0) {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+
+    /* the descriptor stays open until release */
+    fd = sfs_fopeninode(TO_INODE(ino));
+    if (fd == -1) {
+        fuse_reply_err(req, ENFILE);
+        return;
+    }
+
+    fi->fh = fd;
+    fi->keep_cache = 1;
+    fuse_reply_open(req, fi);
+}
+
+static void fuse_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+        mode_t mode, struct fuse_file_info *fi)
+{
+    char filename[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
+    struct fuse_entry_param e;
+    int fd;
+
+    if (TO_INODE(parent) != 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (make_filename(filename, name) == -1) {
+        fuse_reply_err(req, ENAMETOOLONG);
+        return;
+    }
+
+    /* the descriptor stays open until release */
+    fd = sfs_fopen(filename);
+    if (fd == -1) {
+        fuse_reply_err(req, sfs_lookup(filename) == -1 ? ENOSPC : ENFILE);
+        return;
+    }
+
+    fi->fh = fd;
+    fill_entry(sfs_lookup(filename), &e);
+    fuse_reply_create(req, &e, fi);
+}
+
+static void fuse_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+        off_t off, struct fuse_file_info *fi)
+{
+    int max_extents = CEILING(size, BLOCK_SIZE) + 1;
+    file_extent extents[max_extents];
+    struct fuse_bufvec *bufv;
+    int count;
+
+    /* nothing to read past the largest file */
+    if (off > MAX_FILE_SIZE) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+
+    /* the data is not copied here, libfuse moves it from the disk file */
+    count = sfs_fmap(fi->fh, off, size, 0, extents, max_extents);
+    if (count == -1) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    /* the blocks stay with the file until sfs_fmap_release, once the data is out */
+    bufv = make_bufvec(extents, count);
+    if (bufv == NULL)
+        fuse_reply_err(req, ENOMEM);
+    else
+        fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+    free(bufv);
+    sfs_fmap_release();
+}
+
+static void fuse_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *buf,
+        off_t off, struct fuse_file_info *fi)
+{
+    size_t size = fuse_buf_size(buf);
+    int max_extents = CEILING(size, BLOCK_SIZE) + 1;
+    file_extent extents[max_extents];
+    struct iovec iov[buf->count];
+    struct fuse_bufvec *dst;
+    ssize_t res;
+    int count;
+
+    /* the offset must fit the SFS offsets, whichever path the data takes */
+    if (off + size > MAX_FILE_SIZE) {
+        fuse_reply_err(req, EFBIG);
+        return;
+    }
+
+    /* data in memory goes through sfs_pwritev, every fragment in one batch */
+    count = make_iovec(buf, iov);
+    if (count != -1) {
+        res = sfs_pwritev(fi->fh, iov, count, off);
+        if (res == -1)
+            fuse_reply_err(req, EINVAL);
+        else if (res == 0 && size > 0)
+            fuse_reply_err(req, ENOSPC);
+        else
+            fuse_reply_write(req, res);
+        return;
+    }
+
+    /* data spliced from a pipe: allocate the blocks, then let libfuse move it into the disk file */
+    count = sfs_fmap(fi->fh, off, size, 1, extents, max_extents);
+    if (count == -1) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    /* the file stays locked until sfs_fmap_done, which grows it by what was copied */
+    if (count == 0 && size > 0) {
+        sfs_fmap_done(fi->fh, off, 0);
+        fuse_reply_err(req, ENOSPC);
+        return;
+    }
+
+    dst = make_bufvec(extents, count);
+    if (dst == NULL) {
+        sfs_fmap_done(fi->fh, off, 0);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    res = fuse_buf_copy(dst, buf, 0);
+    free(dst);
+    sfs_fmap_done(fi->fh, off, res < 0 ? 0 : res);
+    if (res < 0)
+        fuse_reply_err(req, -res);
+    else
+        fuse_reply_write(req, res);
+}
+
+static void fuse_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    /* hand the cached blocks to the image file */
+    fuse_reply_err(req, sfs_flush() == -1 ? EIO : 0);
+}
+
+static void fuse_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+        struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, sfs_sync() == -1 ? EIO : 0);
+}
+
+static void fuse_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    sfs_fclose(fi->fh);
+    fuse_reply_err(req, 0);
+}
+
+static void fuse_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    char filename[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
+
+    if (TO_INODE(parent) != 0 || make_filename(filename, name) == -1 || sfs_lookup(filename) == -1)
+        fuse_reply_err(req, ENOENT);
+    else if (sfs_remove(filename) == -1)
+        fuse_reply_err(req, EBUSY);
+    else
+        fuse_reply_err(req, 0);
+}
+
+static struct fuse_lowlevel_ops ll_oper = {
+    .init = fuse_ll_init,
+    .destroy = fuse_ll_destroy,
+    .lookup = fuse_ll_lookup,
+    .getattr = fuse_ll_getattr,
+    .setattr = fuse_ll_setattr,
+    .readdir = fuse_ll_readdir,
+    .open = fuse_ll_open,
+    .create = fuse_ll_create,
+    .read = fuse_ll_read,
+    .write_buf = fuse_ll_write_buf,
+    .flush = fuse_ll_flush,
+    .fsync = fuse_ll_fsync,
+    .release = fuse_ll_release,
+    .unlink = fuse_ll_unlink,
+};
+
+int main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_session *se;
+    struct fuse_chan *ch;
+    char *mountpoint;
+    int multithreaded;
+    int err = -1;
+
+    /* mount the existing file system, or create one */
+    mksfs(access(DEFAULT_IMAGE, F_OK) == -1);
+    fs = sfs_default_context();
+    /* a volume that failed to mount has no cache, do not serve requests from it */
+    if (!fs->cache) {
+        fprintf(stderr, "Error, could not mount the file system on %s.\n", DEFAULT_IMAGE);
+        return 1;
+    }
+
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, NULL) != -1 &&
+            (ch = fuse_mount(mountpoint, &args)) != NULL) {
+        se = fuse_lowlevel_new(&args, &ll_oper, sizeof(ll_oper), NULL);
+        if (se != NULL) {
+            if (fuse_set_signal_handlers(se) != -1) {
+                fuse_session_add_chan(se, ch);
+                /* the requests are served by several threads, unless -s is given */
+                err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    fuse_opt_free_args(&args);
+
+    sfs_sync();
+    return err ? 1 : 0;
+}
@@ -13,6 +13,55 @@
 #include "disk_emu.h"
 #include "sfs_api.h"
 
+/* number of files fetched from the directory at once */
+#define READDIR_BATCH 64
+
+/* the volume being served (geometry macros read it) */
+static sfs_context *fs;
+
+/* ( helper ) describe extents of a file as ranges of the disk file, so libfuse can splice them */
+static struct fuse_bufvec *make_bufvec(const file_extent *extents, int count)
+{
+    struct fuse_bufvec *bufv;
+    int i;
+
+    bufv = calloc(1, sizeof(struct fuse_bufvec) + count * sizeof(struct fuse_buf));
+    if (bufv == NULL)
+        return NULL;
+
+    bufv->count = count;
+    for (i = 0; i < count; i++) {
+        bufv->buf[i].size = extents[i].length;
+        bufv->buf[i].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        bufv->buf[i].fd = disk_fd(&fs->disk);
+        bufv->buf[i].pos = extents[i].disk_offset;
+    }
+    return bufv;
+}
+
+/* ( helper ) describe the memory buffers of a bufvec as a vector, so they are written in one batch
+ * return the number of buffers, -1 if part of the data is in a file (a pipe when splicing) */
+static int make_iovec(const struct fuse_bufvec *bufv, struct iovec *iov)
+{
+    size_t i;
+
+    for (i = bufv->idx; i < bufv->count; i++) {
+        if (bufv->buf[i].flags & FUSE_BUF_IS_FD)
+            return -1;
+        iov[i - bufv->idx].iov_base = (char *)bufv->buf[i].mem + (i == bufv->idx ? bufv->off : 0);
+        iov[i - bufv->idx].iov_len = bufv->buf[i].size - (i == bufv->idx ? bufv->off : 0);
+    }
+    return bufv->count - bufv->idx;
+}
+
+static void *fuse_init(struct fuse_conn_info *conn)
+{
+    /* move the written data from the kernel into the disk file without copying it
+     * (reads go through sfs_pread, libfuse copies the data out once the call is over) */
+    conn->want |= FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE | FUSE_CAP_BIG_WRITES;
+    return NULL;
+}
+
 static int fuse_getattr(const char *path, struct stat *stbuf)
 {
     int res = 0;
@@ -36,16 +85,32 @@ static int fuse_getattr(const char *path, struct stat *stbuf)
 static int fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         off_t offset, struct fuse_file_info *fi)
 {
-    char file_name[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
+    readdir_entry entries[READDIR_BATCH];
+    struct stat stbuf;
+    int cookie, count, i;
     
     if (strcmp(path, "/") != 0)
         return -ENOENT;
     
-    filler(buf, ".", NULL, 0);
-    filler(buf, "..", NULL, 0);
+    /* "." and ".." come first, then the file with i-Node n is at offset n+2 */
+    if (offset < 1 && filler(buf, ".", NULL, 1))
+        return 0;
+    if (offset < 2 && filler(buf, "..", NULL, 2))
+        return 0;
     
-    while(sfs_getnextfilename(file_name)) {
-        filler(buf, &file_name[1], NULL, 0);
+    /* list the files in batches, until the buffer is full or every file is listed */
+    cookie = MAX(offset - 1, 1);
+    while ((count = sfs_readdir(cookie, entries, READDIR_BATCH)) > 0) {
+        for (i = 0; i < count; i++) {
+            memset(&stbuf, 0, sizeof(struct stat));
+            stbuf.st_ino = entries[i].i_node_number;
+            stbuf.st_mode = S_IFREG | 0666;
+            stbuf.st_nlink = 1;
+            stbuf.st_size = entries[i].size;
+            if (filler(buf, &entries[i].filename[1], &stbuf, entries[i].i_node_number + 2))
+                return 0;
+        }
+        cookie = entries[count - 1].i_node_number + 1;
     }
     
     return 0;
@@ -66,82 +131,162 @@ static int fuse_unlink(const char *path)
 
 static int fuse_open(const char *path, struct fuse_file_info *fi)
 {
-    int res;
+    int fd;
     char filename[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
     
     strcpy(filename, path);
     
-    res = sfs_fopen(filename);
-    if (res == -1)
-        return -errno;
+    /* the descriptor stays open until release */
+    fd = sfs_fopen(filename);
+    if (fd == -1)
+        return -ENFILE;
     
-    sfs_fclose(res);
+    fi->fh = fd;
     return 0;
 }
 
 static int fuse_read(const char *path, char *buf, size_t size, off_t offset,
         struct fuse_file_info *fi)
 {
-    int fd;
     int res;
     
-    char filename[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
-    
-    strcpy(filename, path);
-    
-    fd = sfs_fopen(filename);
-    if (fd == -1)
-        return -errno;
-    
-    if(sfs_fseek(fd, offset) == -1)
-        return -errno;
+    /* nothing to read past the largest file */
+    if(offset > MAX_FILE_SIZE)
+        return 0;
     
-    res = sfs_fread(fd, buf, size);
+    /* the descriptor is shared by every reader, its pointer is left alone */
+    res = sfs_pread(fi->fh, buf, size, offset);
     if (res == -1)
-        return -errno;
+        return -EINVAL;
     
-    sfs_fclose(fd);
     return res;
 }
 
 static int fuse_write(const char *path, const char *buf, size_t size,
         off_t offset, struct fuse_file_info *fi)
 {
-    int fd;
     int res;
     
-    char filename[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
-    
-    strcpy(filename, path);
-    
-    fd = sfs_fopen(filename);
-    if (fd == -1) 
-        return -errno;
+    if(offset + size > MAX_FILE_SIZE)
+        return -EFBIG;
     
-    if(sfs_fseek(fd, offset) == -1)
-        return -errno;
-    
-    res = sfs_fwrite(fd, buf, size);
+    res = sfs_pwrite(fi->fh, buf, size, offset);
     if (res == -1)
-        return -errno;
+        return -EINVAL;
+    if (res == 0 && size > 0)
+        return -ENOSPC;
     
-    sfs_fclose(fd);
     return res;
 }
 
+static int fuse_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+        struct fuse_file_info *fi)
+{
+    size_t size = fuse_buf_size(buf);
+    int max_extents = CEILING(size, BLOCK_SIZE) + 1;
+    file_extent extents[max_extents];
+    struct iovec iov[buf->count];
+    struct fuse_bufvec *dst;
+    ssize_t res;
+    int count;
+
+    /* the offset must fit the SFS offsets, whichever path the data takes */
+    if (offset + size > MAX_FILE_SIZE)
+        return -EFBIG;
+
+    /* data in memory goes through sfs_pwritev, every fragment in one batch */
+    count = make_iovec(buf, iov);
+    if (count != -1) {
+        res = sfs_pwritev(fi->fh, iov, count, offset);
+        if (res == -1)
+            return -EINVAL;
+        if (res == 0 && size > 0)
+            return -ENOSPC;
+        return res;
+    }
+
+    /* data spliced from a pipe: allocate the blocks, then let libfuse move it into the disk file */
+    count = sfs_fmap(fi->fh, offset, size, 1, extents, max_extents);
+    if (count == -1)
+        return -EINVAL;
+
+    /* the file stays locked until sfs_fmap_done, which grows it by what was copied */
+    if (count == 0 && size > 0) {
+        sfs_fmap_done(fi->fh, offset, 0);
+        return -ENOSPC;
+    }
+
+    dst = make_bufvec(extents, count);
+    if (dst == NULL) {
+        sfs_fmap_done(fi->fh, offset, 0);
+        return -ENOMEM;
+    }
+
+    res = fuse_buf_copy(dst, buf, 0);
+    free(dst);
+    sfs_fmap_done(fi->fh, offset, res < 0 ? 0 : res);
+    return res;
+}
+
+static int fuse_flush(const char *path, struct fuse_file_info *fi)
+{
+    /* hand the cached blocks to the image file */
+    if (sfs_flush() == -1)
+        return -EIO;
+    
+    return 0;
+}
+
+static int fuse_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    if (sfs_sync() == -1)
+        return -EIO;
+    
+    return 0;
+}
+
+static int fuse_release(const char *path, struct fuse_file_info *fi)
+{
+    sfs_fclose(fi->fh);
+    return 0;
+}
+
 static int fuse_truncate(const char *path, off_t size)
 {
     char filename[MAX_FILENAME + MAX_FILE_EXTENSION + 2];
     int fd;
+    int res;
     
     strcpy(filename, path);
     
-    fd = sfs_remove(filename);
-    if (fd == -1)
-        return -errno;
+    if (sfs_getfilesize(filename) == -1)
+        return -ENOENT;
+    
+    /* the size must fit the SFS sizes before it is narrowed */
+    if (size > MAX_FILE_SIZE)
+        return -EFBIG;
     
     fd = sfs_fopen(filename);
+    if (fd == -1)
+        return -ENFILE;
+    
+    res = sfs_ftruncate(fd, size);
     sfs_fclose(fd);
+    if (res == -1)
+        return -ENOSPC;
+    
+    return 0;
+}
+
+static int fuse_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+    /* the size must fit the SFS sizes before it is narrowed */
+    if (size > MAX_FILE_SIZE)
+        return -EFBIG;
+    
+    if (sfs_ftruncate(fi->fh, size) == -1)
+        return -ENOSPC;
+    
     return 0;
 }
 
@@ -161,21 +306,31 @@ static int fuse_create (const char *path, mode_t mode, struct fuse_file_info *fp
     int fd;
     
     strcpy(filename, path);
+    
+    /* the descriptor stays open until release */
     fd = sfs_fopen(filename);
+    if (fd == -1)
+        return -EIO;
     
-    sfs_fclose(fd);
+    fp->fh = fd;
     return 0;
 }
 
 static struct fuse_operations xmp_oper = {
+    .init = fuse_init,
     .getattr = fuse_getattr,
     .readdir = fuse_readdir,
     .mknod = fuse_mknod,
     .unlink = fuse_unlink,
     .truncate = fuse_truncate,
+    .ftruncate = fuse_ftruncate,
     .open = fuse_open, 
     .read = fuse_read, 
     .write = fuse_write, 
+    .write_buf = fuse_write_buf,
+    .flush = fuse_flush,
+    .fsync = fuse_fsync,
+    .release = fuse_release,
     .access = fuse_access,
     .create = fuse_create,
 };
@@ -183,5 +338,13 @@ static struct fuse_operations xmp_oper = {
 int main(int argc, char *argv[])
 {
   mksfs(0);
-  return fuse_main(argc, argv, &xmp_oper, NULL);
+  fs = sfs_default_context();
+  /* a volume that failed to mount has no cache, do not serve requests from it */
+  if (!fs->cache) {
+    fprintf(stderr, "Error, could not mount the file system on %s.\n", DEFAULT_IMAGE);
+    return 1;
+  }
+  int res = fuse_main(argc, argv, &xmp_oper, NULL);
+  sfs_sync();
+  return res;
 }
@@ -6,294 +6,1269 @@
 /* includes */
 #include "sfs_api.h"
 #include "disk_emu.h"
+#include "block_cache.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
-/* data structures (on-disk and in-memory) */
-i_node_table_struct i_node_table; // i-Node table
-directory_table_struct directory_table; // directory table
+/* volume the API functions without a context work on */
+static sfs_context default_volume;
+static pthread_once_t default_volume_once = PTHREAD_ONCE_INIT;
 
-/* data structures (on-disk only) */
-super_block_struct super_block; // super block
-bit_map_struct bit_map; // free block bitmap (1 = free, 0 = allocated)
+/* global variables */
+__thread int current_file_index = 1; // i-Node number the listing of sfs_getnextfilename resumes from (each thread lists on its own)
 
-/* data structures (in-memory only)  */
-FDT_struct FDT; // file descriptor table
+/* ( helper ) tells whether the given block is free */
+int is_block_free(sfs_context *fs, int block){
+    return ( fs->bit_map.is_free[block / BITS_PER_WORD] >> (block % BITS_PER_WORD) ) & 1;
+}
 
-/* global variables */
-int current_file_index, dirs_iterated_over; // index of the current file in the directory, and number of directories parsed over (used in sfs_getnextfilename)
+/* ( helper ) flag the given block as free in the bitmap */
+void set_block_free(sfs_context *fs, int block){
+    fs->bit_map.is_free[block / BITS_PER_WORD] |= ( 1ULL << (block % BITS_PER_WORD) );
+    fs->bit_map.size--;
+    // only the word we changed needs to be written back
+    mark_dirty(fs, &fs->bit_map_region, &fs->bit_map.is_free[block / BITS_PER_WORD], sizeof(uint64_t));
+}
+
+/* ( helper ) flag the given block as allocated in the bitmap, the next search starts right after it */
+void set_block_allocated(sfs_context *fs, int block){
+    fs->bit_map.is_free[block / BITS_PER_WORD] &= ~( 1ULL << (block % BITS_PER_WORD) );
+    fs->bit_map.size++;
+    fs->alloc_cursor = ( block + 1 < NUM_OF_BLOCKS ) ? block + 1 : DATA_BLOCKS_ADDRESS;
+    // only the word we changed needs to be written back
+    mark_dirty(fs, &fs->bit_map_region, &fs->bit_map.is_free[block / BITS_PER_WORD], sizeof(uint64_t));
+}
+
+/* ( helper ) get the blocks of a word of the bitmap that can be allocated (free, not reserved for an open file, and not freed by the transaction) */
+uint64_t available_blocks(sfs_context *fs, int word_index){
+    return fs->bit_map.is_free[word_index] & ~fs->reserved_blocks[word_index] & ~fs->journal.pending_frees[word_index];
+}
 
-/* ( helper ) finds the next free block, return its index */
-int next_free_block(void){
-    // parse the bitmap
-    for( int i=DATA_BLOCKS_ADDRESS; i < NUM_OF_BLOCKS; i ++){
-        // if the current block is free, return its index
-        if ( bit_map.is_free[i] ) return i;
+/* ( helper ) tells whether the given block can be allocated (free, not reserved for an open file, and not freed by the transaction) */
+int is_block_available(sfs_context *fs, int block){
+    return ( available_blocks(fs, block / BITS_PER_WORD) >> (block % BITS_PER_WORD) ) & 1;
+}
+
+/* ( helper ) finds the next available block from the cursor, return its index */
+int next_free_block(sfs_context *fs){
+    // word holding the cursor, ignoring the blocks that come before the cursor in it
+    int word_index = fs->alloc_cursor / BITS_PER_WORD;
+    uint64_t word = available_blocks(fs, word_index) & ( ~0ULL << (fs->alloc_cursor % BITS_PER_WORD) );
+    // parse the bitmap a word at a time, wrapping around to the first word (the last pass re-checks the blocks before the cursor)
+    for( int i=0; i <= BITMAP_WORDS; i++ ){
+        // if any block in this word is available, return the index of the first one
+        if ( word ) return word_index * BITS_PER_WORD + __builtin_ctzll(word);
+        if ( ++word_index == BITMAP_WORDS ) word_index = 0;
+        word = available_blocks(fs, word_index);
     }
     // on failure return -1
     return -1;
 }
 
+/* ( helper ) count the available blocks that follow each other from the given block (at most max of them) */
+int free_run_length(sfs_context *fs, int start, int max){
+    int length = 0;
+    while ( length < max && start + length < NUM_OF_BLOCKS ) {
+        int block = start + length;
+        // the unavailable blocks of the word, from this block on
+        uint64_t taken = ~available_blocks(fs, block / BITS_PER_WORD) >> (block % BITS_PER_WORD);
+        // the run stops at the first one, or goes on into the next word
+        if ( taken ) return MIN(length + __builtin_ctzll(taken), max);
+        length += BITS_PER_WORD - block % BITS_PER_WORD;
+    }
+    return MIN(length, max);
+}
+
+/* ( helper ) find a run of available blocks, return its first block and set its length (at most wanted), -1 if the disk is full
+ * the goal is taken whenever it is available (a file growing in place stays contiguous, however short the run),
+ * otherwise the first run of wanted blocks from the cursor, or the longest run there is */
+int find_free_run(sfs_context *fs, int goal, int wanted, int *length){
+    if ( goal >= DATA_BLOCKS_ADDRESS && goal < NUM_OF_BLOCKS && is_block_available(fs, goal) ) {
+        *length = free_run_length(fs, goal, wanted);
+        return goal;
+    }
+    // parse the bitmap from the cursor to the end, then from the first data block to the cursor
+    int best = -1, best_length = 0;
+    for ( int pass = 0; pass < 2; pass++ ) {
+        int block = pass ? DATA_BLOCKS_ADDRESS : fs->alloc_cursor;
+        int end = pass ? fs->alloc_cursor : NUM_OF_BLOCKS;
+        while ( block < end ) {
+            // skip to the next available block, a word at a time
+            uint64_t word = available_blocks(fs, block / BITS_PER_WORD) >> (block % BITS_PER_WORD);
+            if ( !word ) {
+                block += BITS_PER_WORD - block % BITS_PER_WORD;
+                continue;
+            }
+            block += __builtin_ctzll(word);
+            if ( block >= end ) break;
+            // measure the run that starts there, and keep the longest
+            int run = free_run_length(fs, block, wanted);
+            if ( run > best_length ) {
+                best = block;
+                best_length = run;
+                if ( run == wanted ) break;
+            }
+            block += run;
+        }
+        if ( best_length == wanted ) break;
+    }
+    *length = best_length;
+    return best;
+}
+
+/* ( helper ) flag a run of blocks as reserved (or not) for an open file, in memory only */
+void set_blocks_reserved(sfs_context *fs, int start, int length, int reserved){
+    for ( int block = start; block < start + length; block++ ) {
+        if ( reserved ) fs->reserved_blocks[block / BITS_PER_WORD] |= ( 1ULL << (block % BITS_PER_WORD) );
+        else fs->reserved_blocks[block / BITS_PER_WORD] &= ~( 1ULL << (block % BITS_PER_WORD) );
+    }
+}
+
+/* ( helper ) reserve a run of blocks for an open file to grow into, return -1 if the disk is full
+ * the run covers the blocks the write needs, and the window of the file, which doubles each time the file outgrows it
+ * and it starts right after the last block of the file whenever that block is available */
+int reserve_blocks( sfs_context *fs, open_file_entry *entry, i_node *file, int needed ){
+    drop_reservation(fs, entry);
+    entry->window = MIN(MAX(2 * entry->window, MIN_RESERVATION), MAX_RESERVATION);
+    int wanted = MAX(needed, entry->window);
+    // the block right after the file is the goal
+    extent *last = file->num_of_extents ? &entry->map.extents[file->num_of_extents-1] : NULL;
+    int goal = last ? last->start + last->length : fs->alloc_cursor;
+    int length, start = find_free_run(fs, goal, wanted, &length);
+    // if the disk is short on space, the other open files give their reservations back
+    if ( start == -1 ) {
+        for ( int i=0; i < MAX_FILES; i++ ) drop_reservation(fs, &fs->FDT.open_files[i]);
+        start = find_free_run(fs, goal, wanted, &length);
+        if ( start == -1 ) return -1;
+    }
+    set_blocks_reserved(fs, start, length, 1);
+    entry->reserved_start = start;
+    entry->reserved_length = length;
+    return 0;
+}
+
+/* ( helper ) give back the blocks an open file reserved but did not use */
+void drop_reservation( sfs_context *fs, open_file_entry *entry ){
+    set_blocks_reserved(fs, entry->reserved_start, entry->reserved_length, 0);
+    entry->reserved_length = 0;
+}
+
+/* ( helper ) free the given run of blocks in the bitmap, and discard their content
+ * nothing is written to them: the cache drops its copies, and once the transaction commits the disk may give the space back
+ * (until then they are not reused, a crash would leave them to the file they belonged to) */
+void release_blocks( sfs_context *fs, int start_address, int nblocks ){
+    pthread_mutex_lock(&fs->allocator_lock);
+    for ( int i=0; i < nblocks; i++ ) {
+        int block = start_address + i;
+        set_block_free(fs, block);
+        fs->journal.pending_frees[block / BITS_PER_WORD] |= ( 1ULL << (block % BITS_PER_WORD) );
+    }
+    fs->journal.num_of_pending_frees += nblocks;
+    pthread_mutex_unlock(&fs->allocator_lock);
+    cache_invalidate(fs->cache, start_address, nblocks);
+}
+
 /* ( helper ) finds the next free entry in the directory table */
-int next_free_dir_entry(void){
+int next_free_dir_entry(sfs_context *fs){
     // parse every file
     for ( int i=0; i < MAX_FILES; i++ ) {
         // if this index is free
-        if ( directory_table.directories[i].free ) return i;
+        if ( fs->directory_table.directories[i].free ) return i;
     }
     // on failure, return -1
     return -1;
 }
 
-/* ( helper ) finds the index of the given file in the directory table */
-int get_dir_index(const char *file){
-    // number of directories
-    int dirs = directory_table.num_of_dir;
-    // parse every file
+/* ( helper ) hash a file name (FNV-1a), return its bucket in the directory index */
+unsigned int hash_filename(sfs_context *fs, const char *file){
+    unsigned int hash = 2166136261u;
+    while ( *file ) {
+        hash ^= (unsigned char)*file++;
+        hash *= 16777619u;
+    }
+    return hash & ( fs->directory_index.num_of_buckets - 1 );
+}
+
+/* ( helper ) add the directory entry at the given index to the directory index */
+void dir_index_insert(sfs_context *fs, int index){
+    unsigned int bucket = hash_filename(fs, fs->directory_table.directories[index].filename);
+    // push it at the head of its bucket
+    fs->directory_index.next[index] = fs->directory_index.heads[bucket];
+    fs->directory_index.heads[bucket] = index;
+}
+
+/* ( helper ) remove the directory entry at the given index from the directory index */
+void dir_index_remove(sfs_context *fs, int index){
+    unsigned int bucket = hash_filename(fs, fs->directory_table.directories[index].filename);
+    // find the link that points to this entry, and skip over it
+    int *link = &fs->directory_index.heads[bucket];
+    while ( *link != -1 && *link != index ) link = &fs->directory_index.next[*link];
+    if ( *link == index ) *link = fs->directory_index.next[index];
+    fs->directory_index.next[index] = -1;
+}
+
+/* ( helper ) rebuild the directory index from the directory table */
+void build_dir_index(sfs_context *fs){
+    // start with empty buckets
+    for ( int i=0; i < fs->directory_index.num_of_buckets; i++ ) fs->directory_index.heads[i] = -1;
+    // add every allocated entry
     for ( int i=0; i < MAX_FILES; i++ ) {
-        // if this index is allocated
-        if ( !(directory_table.directories[i].free) ) {
-            dirs--;
-            // if the file name matches the path, return the index
-            if (!strcmp(file, directory_table.directories[i].filename)) {
-                return i;
-            }
-        }
-        // if no file in the directory matches the path
-        if ( !dirs ) break;
+        fs->directory_index.next[i] = -1;
+        if ( !(fs->directory_table.directories[i].free) ) dir_index_insert(fs, i);
+    }
+}
+
+/* ( helper ) finds the index of the given file in the directory table */
+int get_dir_index(sfs_context *fs, const char *file){
+    // no file system is mounted
+    if ( !fs->directory_index.heads ) return -1;
+    // only the entries that share the file's bucket need to be compared
+    for ( int i = fs->directory_index.heads[hash_filename(fs, file)]; i != -1; i = fs->directory_index.next[i] ) {
+        // if the file name matches the path, return the index
+        if ( !strcmp(file, fs->directory_table.directories[i].filename) ) return i;
     }
     // on failure, return -1
     return -1;
 }
 
-/* ( helper ) add a file to the FDT and return its index */
-int create_FDT_entry(int i_node){
-    // add the file corresponding to this i-Node number to the next free spot in the FDT
-    for (int i=0; i<=MAX_FILES; i++){
-        // if the current index is free, create the entry there
-        if( FDT.file_descriptors[i].i_node_number == -1 ){
-            // we set the pointers at the end of the file
-            FDT.file_descriptors[i].i_node_number = i_node;
-            FDT.file_descriptors[i].read_write_ptr = i_node_table.i_nodes[i_node].size;
-            // open the file (set active)
-            i_node_table.i_nodes[i_node].mode = ACTIVE;
-            // update the number of opened files
-            FDT.num_of_files++;
-            // return the index
-            return i;
+/* ( helper ) load the extents of the given i-Node into an extent map */
+int load_extent_map( sfs_context *fs, extent_map *map, int i_node_number ){
+    i_node *file = &fs->i_node_table.i_nodes[i_node_number];
+    // room for whole leaves of extents (the map grows with the file)
+    map->capacity = CEILING(MAX(file->num_of_extents, 1), EXTENTS_PER_LEAF) * EXTENTS_PER_LEAF;
+    map->extents = calloc(map->capacity, sizeof(extent));
+    map->first_blocks = calloc(map->capacity, sizeof(int));
+    map->leaves = ( file->extent_index != -1 ) ? malloc(LEAVES_PER_INDEX * sizeof(int)) : NULL;
+    if ( !map->extents || !map->first_blocks || ( file->extent_index != -1 && !map->leaves ) ) {
+        fprintf(stderr,"Error, could not allocate an extent map.\n");
+        free_extent_map(map);
+        return -1;
+    }
+    // the extents are held by the i-Node, or by the leaf blocks listed in its index block
+    if ( map->leaves ) journal_read_block(fs, file->extent_index, map->leaves);
+    if ( file->num_of_extents <= NUM_OF_INLINE_EXTENTS ) memcpy(map->extents, file->extents, file->num_of_extents * sizeof(extent));
+    else for ( int i=0; i < CEILING(file->num_of_extents, EXTENTS_PER_LEAF); i++ ) {
+        journal_read_block(fs, map->leaves[i], map->extents + i*EXTENTS_PER_LEAF);
+    }
+    // index (in the file) of the first block of each extent
+    for ( int i=0, block=0; i < file->num_of_extents; block += map->extents[i++].length ) map->first_blocks[i] = block;
+    // the disk is up to date
+    map->first_dirty = file->num_of_extents;
+    map->leaves_dirty = 0;
+    return 0;
+}
+
+/* ( helper ) release the memory held by an extent map */
+void free_extent_map( extent_map *map ){
+    free(map->extents);
+    free(map->first_blocks);
+    free(map->leaves);
+    map->extents = NULL;
+    map->first_blocks = map->leaves = NULL;
+    map->capacity = 0;
+}
+
+/* ( helper ) get the address of the given block of a file (which must exist)
+ * and, unless run is NULL, the number of blocks that follow from it on the disk in the same extent (itself included) */
+int map_block( const extent_map *map, const i_node *file, int block, int *run ){
+    // binary search for the last extent that starts at or before the block
+    int low = 0, high = file->num_of_extents - 1;
+    while ( low < high ) {
+        int middle = ( low + high + 1 ) / 2;
+        if ( map->first_blocks[middle] <= block ) low = middle;
+        else high = middle - 1;
+    }
+    int offset = block - map->first_blocks[low];
+    if ( run ) *run = map->extents[low].length - offset;
+    return map->extents[low].start + offset;
+}
+
+/* ( helper ) make room for one more extent in the map of a file, and on the disk, return -1 if there is none */
+int add_extent_room( sfs_context *fs, extent_map *map, i_node *file ){
+    int num = file->num_of_extents;
+    // if the index block can not list another leaf
+    if ( num == MAX_EXTENTS_PER_FILE ) {
+        fprintf(stderr,"Error, the file is too fragmented.\n");
+        return -1;
+    }
+    // grow the arrays of the map (by whole leaves)
+    if ( num == map->capacity ) {
+        extent *extents = realloc(map->extents, 2 * map->capacity * sizeof(extent));
+        if ( extents ) map->extents = extents;
+        int *first_blocks = realloc(map->first_blocks, 2 * map->capacity * sizeof(int));
+        if ( first_blocks ) map->first_blocks = first_blocks;
+        if ( !extents || !first_blocks ) {
+            fprintf(stderr,"Error, could not allocate an extent map.\n");
+            return -1;
         }
+        memset(map->extents + map->capacity, 0, map->capacity * sizeof(extent));
+        map->capacity *= 2;
     }
-    // on failure return -1
+    // past what the i-Node holds, the extents move to leaf blocks listed by an index block
+    if ( num >= NUM_OF_INLINE_EXTENTS && file->extent_index == -1 ) {
+        map->leaves = malloc(LEAVES_PER_INDEX * sizeof(int));
+        pthread_mutex_lock(&fs->allocator_lock);
+        int index_address = next_free_block(fs);
+        if ( map->leaves && index_address != -1 ) set_block_allocated(fs, index_address);
+        pthread_mutex_unlock(&fs->allocator_lock);
+        if ( !map->leaves || index_address == -1 ) {
+            fprintf(stderr,"Error, could not allocate an index block.\n");
+            free(map->leaves);
+            map->leaves = NULL;
+            return -1;
+        }
+        file->extent_index = index_address;
+        for ( int i=0; i < LEAVES_PER_INDEX; i++ ) map->leaves[i] = -1;
+        map->leaves_dirty = 1;
+    }
+    // and every EXTENTS_PER_LEAF extents, a new leaf block
+    if ( num >= NUM_OF_INLINE_EXTENTS && map->leaves[num / EXTENTS_PER_LEAF] == -1 ) {
+        pthread_mutex_lock(&fs->allocator_lock);
+        int leaf_address = next_free_block(fs);
+        if ( leaf_address != -1 ) set_block_allocated(fs, leaf_address);
+        pthread_mutex_unlock(&fs->allocator_lock);
+        if ( leaf_address == -1 ) {
+            fprintf(stderr,"Error, could not allocate a leaf block.\n");
+            return -1;
+        }
+        map->leaves[num / EXTENTS_PER_LEAF] = leaf_address;
+        map->leaves_dirty = 1;
+    }
+    // when the extents leave the i-Node, they must all be written to the leaves
+    if ( num == NUM_OF_INLINE_EXTENTS ) map->first_dirty = 0;
+    return 0;
+}
+
+/* ( helper ) write the extents that changed to the i-Node or to their leaf blocks (and the index block if it changed)
+ * the i-Node is written back by the caller, the leaf and index blocks go through the transaction along with it */
+void store_extent_map( sfs_context *fs, extent_map *map, i_node *file ){
+    int num = file->num_of_extents;
+    // the i-Node holds the extents
+    if ( num <= NUM_OF_INLINE_EXTENTS ) memcpy(file->extents, map->extents, num * sizeof(extent));
+    // or the leaves do, only the ones holding extents that changed are written
+    else if ( map->first_dirty < num ) {
+        for ( int i = map->first_dirty / EXTENTS_PER_LEAF; i < CEILING(num, EXTENTS_PER_LEAF); i++ ) {
+            journal_write_block(fs, map->leaves[i], map->extents + i*EXTENTS_PER_LEAF);
+        }
+    }
+    if ( map->leaves_dirty ) journal_write_block(fs, file->extent_index, map->leaves);
+    // the disk is up to date
+    map->first_dirty = num;
+    map->leaves_dirty = 0;
+}
+
+/* ( helper ) cut a file down to its first num_of_blocks blocks, and release the blocks past them
+ * (along with the leaf blocks that no longer hold extents, and the index block once the extents fit in the i-Node) */
+void truncate_extent_map( sfs_context *fs, extent_map *map, i_node *file, int num_of_blocks ){
+    // release the data blocks, from the last extent back to the one holding the new last block
+    while ( file->num_of_extents ) {
+        extent *last = &map->extents[file->num_of_extents-1];
+        int keep = num_of_blocks - map->first_blocks[file->num_of_extents-1];
+        if ( keep >= last->length ) break;
+        if ( keep > 0 ) {
+            release_blocks(fs, last->start + keep, last->length - keep);
+            last->length = keep;
+            break;
+        }
+        release_blocks(fs, last->start, last->length);
+        file->num_of_extents--;
+    }
+    file->link_count = MIN(file->link_count, num_of_blocks);
+    map->first_dirty = MIN(map->first_dirty, MAX(file->num_of_extents - 1, 0));
+    // release the leaf blocks past the ones still needed (they are allocated in order)
+    if ( map->leaves ) {
+        int needed = ( file->num_of_extents > NUM_OF_INLINE_EXTENTS ) ? CEILING(file->num_of_extents, EXTENTS_PER_LEAF) : 0;
+        for ( int i = needed; i < LEAVES_PER_INDEX && map->leaves[i] != -1; i++ ) {
+            release_blocks(fs, map->leaves[i], 1);
+            map->leaves[i] = -1;
+            map->leaves_dirty = 1;
+        }
+        // and the index block if the extents fit in the i-Node again
+        if ( !needed ) {
+            release_blocks(fs, file->extent_index, 1);
+            file->extent_index = -1;
+            free(map->leaves);
+            map->leaves = NULL;
+            map->leaves_dirty = 0;
+        }
+    }
+    // write the remaining extents back
+    store_extent_map(fs, map, file);
+}
+
+/* ( helper ) add a descriptor of a file to the FDT and return its index (with the lock of its i-Node held for writing)
+ * the descriptors of a file share its entry in the open file table, the first one loads the extent map */
+int create_FDT_entry(sfs_context *fs, int i_node){
+    open_file_entry *file = &fs->FDT.open_files[i_node];
+    // load the extents of the file, unless it is already open
+    if ( !file->ref_count ) {
+        if ( load_extent_map(fs, &file->map, i_node) == -1 ) return -1;
+        // the file reserves no block until it grows (a closed file holds no reservation)
+        file->window = 0;
+    }
+    // claim the first free spot in the FDT
+    pthread_mutex_lock(&fs->FDT_lock);
+    int i = fs->FDT.first_free;
+    if ( i != -1 ) {
+        fs->FDT.first_free = fs->FDT.file_descriptors[i].next_free;
+        fs->FDT.file_descriptors[i].i_node_number = i_node;
+        // update the number of open descriptors
+        fs->FDT.num_of_files++;
+    }
+    pthread_mutex_unlock(&fs->FDT_lock);
+    // on failure return -1 (and drop the extents, unless another descriptor uses them)
+    if ( i == -1 ) {
+        if ( !file->ref_count ) free_extent_map(&file->map);
+        return -1;
+    }
+    file->ref_count++;
+    // we set the pointer at the end of the file
+    fs->FDT.file_descriptors[i].read_write_ptr = fs->i_node_table.i_nodes[i_node].size;
+    // return the index
+    return i;
+}
+
+/* ( helper ) lock the file open under the given file descriptor, for reading or for writing (along with the transaction)
+ * return its i-Node number, or -1 if no file is open under this descriptor (nothing is locked then) */
+int lock_file(sfs_context *fs, int fileID, int writing){
+    // if the file ID is invalid
+    if ( fileID < 0 || fileID >= MAX_DESCRIPTORS ) {
+        fprintf(stderr,"Error, invalid file ID %d.\n", fileID);
+        return -1;
+    }
+    if ( writing ) pthread_rwlock_rdlock(&fs->transaction_lock);
+    // i-Node number
+    pthread_mutex_lock(&fs->FDT_lock);
+    int i_node = fs->FDT.file_descriptors[fileID].i_node_number;
+    pthread_mutex_unlock(&fs->FDT_lock);
+    if ( i_node != -1 ) {
+        if ( writing ) pthread_rwlock_wrlock(&fs->i_node_locks[i_node]);
+        else pthread_rwlock_rdlock(&fs->i_node_locks[i_node]);
+        // unless the file was closed meanwhile, it stays open until we unlock it
+        pthread_mutex_lock(&fs->FDT_lock);
+        int still_open = fs->FDT.file_descriptors[fileID].i_node_number == i_node;
+        pthread_mutex_unlock(&fs->FDT_lock);
+        if ( still_open ) return i_node;
+        pthread_rwlock_unlock(&fs->i_node_locks[i_node]);
+    }
+    if ( writing ) pthread_rwlock_unlock(&fs->transaction_lock);
+    // if there isn't an open file associated to this ID
+    fprintf(stderr,"Error, no open file is associated with file ID %d.\n", fileID);
     return -1;
 }
 
-/* ( helper ) write the i-Node table to the disk */
-void write_i_node( int index ){
-    // buffer for the block
-    i_node i_node_table_block[I_NODE_TABLE_BLOCKS*BLOCK_SIZE];
-    // read the i-Node table from the disk to the buffer
-    read_blocks(I_NODE_TABLE_ADDRESS, I_NODE_TABLE_BLOCKS, &i_node_table_block);
-    // update the i-Node at the given index
-    i_node_table_block[index].mode = i_node_table.i_nodes[index].mode;
-    i_node_table_block[index].size = i_node_table.i_nodes[index].size;
-    i_node_table_block[index].link_count = i_node_table.i_nodes[index].link_count;
-    for( int j=0; j < NUM_OF_DIR_PTR; j++) i_node_table_block[index].direct_ptr[j] = i_node_table.i_nodes[index].direct_ptr[j];
-    i_node_table_block[index].indirect_ptr= i_node_table.i_nodes[index].indirect_ptr;
-    // write the updated table to memory
-    write_blocks(I_NODE_TABLE_ADDRESS, I_NODE_TABLE_BLOCKS, &i_node_table_block);
+/* ( helper ) lock an open file for writing, once the transaction has room for the leaf and index blocks the operation can
+ * write while the file grows to cover length bytes from offset (a negative offset stands for the read/write pointer)
+ * the transaction commits first if it is too full, return the i-Node number, or -1 if no file is open under this descriptor */
+int lock_file_growing(sfs_context *fs, int fileID, int offset, int length){
+    while ( 1 ) {
+        int i_node = lock_file(fs, fileID, 1);
+        if ( i_node == -1 ) return -1;
+        long end = (long)( offset < 0 ? fs->FDT.file_descriptors[fileID].read_write_ptr : offset ) + length;
+        int needed = journal_room_needed(fs, i_node, end);
+        // the blocks already in the transaction count, along with the room the other operations set aside
+        pthread_mutex_lock(&fs->journal_lock);
+        int room = fs->journal.num_of_blocks + fs->journal.reserved + needed <= JOURNAL_LEAF_ROOM;
+        if ( room ) fs->journal.reserved += needed;
+        pthread_mutex_unlock(&fs->journal_lock);
+        if ( room ) {
+            fs->FDT.open_files[i_node].journal_room = needed;
+            return i_node;
+        }
+        // otherwise, try again once the transaction committed or the other operations are over
+        unlock_file(fs, i_node, 1);
+        wait_journal_room(fs, needed);
+    }
+}
+
+/* ( helper ) unlock a file locked by lock_file (or lock_file_growing) */
+void unlock_file(sfs_context *fs, int i_node, int writing){
+    // give back the room the operation set aside in the transaction
+    open_file_entry *entry = &fs->FDT.open_files[i_node];
+    if ( writing && entry->journal_room ) {
+        pthread_mutex_lock(&fs->journal_lock);
+        fs->journal.reserved -= entry->journal_room;
+        pthread_cond_broadcast(&fs->journal_room);
+        pthread_mutex_unlock(&fs->journal_lock);
+        entry->journal_room = 0;
+    }
+    pthread_rwlock_unlock(&fs->i_node_locks[i_node]);
+    if ( writing ) pthread_rwlock_unlock(&fs->transaction_lock);
+}
+
+/* ( helper ) flag the blocks of a metadata region that hold the given bytes of its table as dirty */
+void mark_dirty( sfs_context *fs, metadata_region *region, const void *field, int length ){
+    // offset of the field in the table
+    int offset = (int)( (const char *)field - (const char *)region->table );
+    // flag every block the field overlaps
+    pthread_mutex_lock(&fs->journal_lock);
+    for( int i = offset / BLOCK_SIZE; i <= (offset + length - 1) / BLOCK_SIZE; i++ ) region->dirty[i] = 1;
+    pthread_mutex_unlock(&fs->journal_lock);
+}
+
+/* ( helper ) read a metadata region from the disk into its table */
+void load_region( sfs_context *fs, metadata_region *region ){
+    // the blocks entirely covered by the table are read in place
+    int full_blocks = region->size / BLOCK_SIZE;
+    if ( full_blocks ) read_blocks(&fs->disk, region->address, full_blocks, region->table);
+    // the table rarely ends on a block boundary, the last block goes through a buffer
+    if ( full_blocks < region->num_of_blocks ) {
+        char tail_block[BLOCK_SIZE];
+        memset(tail_block, 0, BLOCK_SIZE);
+        read_blocks(&fs->disk, region->address + full_blocks, 1, tail_block);
+        memcpy((char *)region->table + full_blocks*BLOCK_SIZE, tail_block, region->size - full_blocks*BLOCK_SIZE);
+    }
+    // the disk is up to date
+    memset(region->dirty, 0, region->num_of_blocks);
+}
+
+/* ( helper ) write the dirty blocks of a metadata region to the disk (consecutive blocks are written at once) */
+void flush_region( sfs_context *fs, metadata_region *region ){
+    // number of blocks entirely covered by the table
+    int full_blocks = region->size / BLOCK_SIZE;
+    int i = 0;
+    while ( i < region->num_of_blocks ) {
+        // skip the blocks that are up to date
+        if ( !region->dirty[i] ) {
+            i++;
+            continue;
+        }
+        // find the run of dirty blocks that starts here, and clear their flags
+        int end = i;
+        while ( end < region->num_of_blocks && region->dirty[end] ) region->dirty[end++] = 0;
+        // write the blocks entirely covered by the table straight from memory
+        int last_full = MIN(end, full_blocks);
+        if ( last_full > i ) write_blocks(&fs->disk, region->address + i, last_full - i, (char *)region->table + i*BLOCK_SIZE);
+        // the last block of the table is padded with zeros
+        if ( end > last_full ) {
+            char tail_block[BLOCK_SIZE];
+            memset(tail_block, 0, BLOCK_SIZE);
+            memcpy(tail_block, (char *)region->table + full_blocks*BLOCK_SIZE, region->size - full_blocks*BLOCK_SIZE);
+            write_blocks(&fs->disk, region->address + full_blocks, 1, tail_block);
+        }
+        i = end;
+    }
+}
+
+/* ( helper ) write every dirty metadata block (i-Node table, bitmap, directory) in place on the disk */
+void flush_metadata( sfs_context *fs ){
+    flush_region(fs, &fs->i_node_region);
+    flush_region(fs, &fs->bit_map_region);
+    flush_region(fs, &fs->directory_region);
+}
+
+/* ( helper ) flag the i-Node at the given index so it gets written to the disk */
+void mark_i_node_dirty( sfs_context *fs, int index ){
+    mark_dirty(fs, &fs->i_node_region, &fs->i_node_table.i_nodes[index], sizeof(i_node));
+}
+
+/* ( helper ) flag the directory entry at the given index so it gets written to the disk */
+void mark_dir_entry_dirty( sfs_context *fs, int index ){
+    mark_dirty(fs, &fs->directory_region, &fs->directory_table.directories[index], sizeof(directory_entry));
+}
+
+/* ( helper ) get the current time (in ms) */
+long current_time( void ){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+/* ( helper ) checksum of a series of bytes (FNV-1a, a 64 bit word at a time, the length is a multiple of 8) */
+uint64_t journal_checksum( const char *bytes, long length ){
+    uint64_t hash = 14695981039346656037ULL, word;
+    for ( long i=0; i < length; i += sizeof(uint64_t) ) {
+        memcpy(&word, bytes + i, sizeof(uint64_t));
+        hash = ( hash ^ word ) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* ( helper ) write a leaf or index block through the transaction (it is written in place once the transaction commits) */
+void journal_write_block( sfs_context *fs, int address, const void *buffer ){
+    int *addresses = (int *)( fs->journal.buffer + sizeof(journal_header) );
+    pthread_mutex_lock(&fs->journal_lock);
+    // a block the transaction already writes gets its new content
+    int i = 0;
+    while ( i < fs->journal.num_of_blocks && addresses[i] != address ) i++;
+    // (the operations set room aside beforehand, so the transaction never outgrows the journal)
+    if ( i == JOURNAL_LEAF_ROOM ) {
+        pthread_mutex_unlock(&fs->journal_lock);
+        fprintf(stderr,"Error, the transaction outgrew the journal.\n");
+        return;
+    }
+    if ( i == fs->journal.num_of_blocks ) addresses[fs->journal.num_of_blocks++] = address;
+    memcpy(fs->journal.buffer + ( JOURNAL_DESCRIPTOR_BLOCKS + (long)i ) * BLOCK_SIZE, buffer, BLOCK_SIZE);
+    // the cache must not keep the previous content
+    cache_invalidate(fs->cache, address, 1);
+    pthread_mutex_unlock(&fs->journal_lock);
+}
+
+/* ( helper ) read a leaf or index block, as the transaction left it */
+void journal_read_block( sfs_context *fs, int address, void *buffer ){
+    int *addresses = (int *)( fs->journal.buffer + sizeof(journal_header) );
+    pthread_mutex_lock(&fs->journal_lock);
+    for ( int i=0; i < fs->journal.num_of_blocks; i++ ) {
+        if ( addresses[i] == address ) {
+            memcpy(buffer, fs->journal.buffer + ( JOURNAL_DESCRIPTOR_BLOCKS + (long)i ) * BLOCK_SIZE, BLOCK_SIZE);
+            pthread_mutex_unlock(&fs->journal_lock);
+            return;
+        }
+    }
+    cache_read_blocks(fs->cache, address, 1, buffer);
+    pthread_mutex_unlock(&fs->journal_lock);
+}
+
+/* ( helper ) the transaction that freed the pending blocks committed : they can be reused, and their content is discarded */
+void release_pending_frees( sfs_context *fs ){
+    pthread_mutex_lock(&fs->allocator_lock);
+    // (a mapped read may still be copying from them, they wait for a later commit then)
+    if ( !fs->journal.num_of_pending_frees || fs->read_maps ) {
+        pthread_mutex_unlock(&fs->allocator_lock);
+        return;
+    }
+    // discard each run of pending blocks at once (the padding bits past the last block are never pending)
+    int run_start = -1;
+    for ( int block = 0; block < BITMAP_WORDS * BITS_PER_WORD; block++ ) {
+        uint64_t word = fs->journal.pending_frees[block / BITS_PER_WORD];
+        // skip the words without pending blocks
+        if ( run_start == -1 && !word ) {
+            block += BITS_PER_WORD - 1 - block % BITS_PER_WORD;
+            continue;
+        }
+        int pending = ( word >> (block % BITS_PER_WORD) ) & 1;
+        if ( pending && run_start == -1 ) run_start = block;
+        if ( !pending && run_start != -1 ) {
+            discard_blocks(&fs->disk, run_start, block - run_start);
+            run_start = -1;
+        }
+    }
+    if ( run_start != -1 ) discard_blocks(&fs->disk, run_start, NUM_OF_BLOCKS - run_start);
+    memset(fs->journal.pending_frees, 0, BITMAP_WORDS * sizeof(uint64_t));
+    fs->journal.num_of_pending_frees = 0;
+    pthread_mutex_unlock(&fs->allocator_lock);
+}
+
+/* ( helper ) commit the transaction (with the transaction lock held alone) : the metadata blocks it changed are written to
+ * the journal in one go, then in place (the data blocks are written first, so the metadata never points at blocks that hold
+ * something else), return -1 on failure */
+int commit_transaction( sfs_context *fs ){
+    // no file system is mounted
+    if ( !fs->journal.buffer ) return 0;
+    journal_header *header = (journal_header *)fs->journal.buffer;
+    int *addresses = (int *)( fs->journal.buffer + sizeof(journal_header) );
+    char *blocks = fs->journal.buffer + JOURNAL_DESCRIPTOR_BLOCKS * BLOCK_SIZE;
+    // the data blocks reach the disk first, along with the blocks the last commit wrote in place
+    if ( cache_flush(fs->cache) || sync_disk(&fs->disk) ) return -1;
+    // the dirty blocks of the metadata tables join the leaf and index blocks of the transaction
+    metadata_region *regions[] = { &fs->i_node_region, &fs->bit_map_region, &fs->directory_region };
+    int num_of_blocks = fs->journal.num_of_blocks;
+    for ( int r=0; r < 3; r++ ) {
+        for ( int i=0; i < regions[r]->num_of_blocks; i++ ) {
+            if ( !regions[r]->dirty[i] ) continue;
+            // the last block of a table is padded with zeros
+            char *block = blocks + (long)num_of_blocks * BLOCK_SIZE;
+            int length = MIN(BLOCK_SIZE, regions[r]->size - i*BLOCK_SIZE);
+            memcpy(block, (char *)regions[r]->table + (long)i*BLOCK_SIZE, length);
+            memset(block + length, 0, BLOCK_SIZE - length);
+            addresses[num_of_blocks++] = regions[r]->address + i;
+        }
+    }
+    pthread_mutex_lock(&fs->journal_lock);
+    fs->journal.last_commit = current_time();
+    pthread_mutex_unlock(&fs->journal_lock);
+    // nothing changed (the pending frees were held back by a mapped read, a past transaction freed them)
+    if ( !num_of_blocks ) {
+        release_pending_frees(fs);
+        return 0;
+    }
+    // write the transaction to the journal in one go, it is committed once it is on the disk
+    strcpy(header->magic, JOURNAL_MAGIC);
+    header->sequence = ++fs->journal.sequence;
+    header->num_of_blocks = num_of_blocks;
+    header->checksum = journal_checksum(fs->journal.buffer + sizeof(journal_header), (long)( JOURNAL_DESCRIPTOR_BLOCKS + num_of_blocks ) * BLOCK_SIZE - sizeof(journal_header));
+    if ( write_blocks(&fs->disk, JOURNAL_ADDRESS, JOURNAL_DESCRIPTOR_BLOCKS + num_of_blocks, fs->journal.buffer) < 0 || sync_disk(&fs->disk) ) {
+        fprintf(stderr,"Error, could not write to the journal.\n");
+        return -1;
+    }
+    // then write its blocks in place (a crash from now on is repaired by replaying the journal)
+    flush_metadata(fs);
+    for ( int i=0; i < fs->journal.num_of_blocks; i++ ) write_blocks(&fs->disk, addresses[i], 1, blocks + (long)i*BLOCK_SIZE);
+    pthread_mutex_lock(&fs->journal_lock);
+    fs->journal.num_of_blocks = 0;
+    pthread_mutex_unlock(&fs->journal_lock);
+    // the blocks the transaction freed can be reused
+    release_pending_frees(fs);
+    return 0;
+}
+
+/* commit the transaction once the operations in progress are over, return -1 on failure */
+int journal_commit( sfs_context *fs ){
+    pthread_rwlock_wrlock(&fs->transaction_lock);
+    int res = commit_transaction(fs);
+    pthread_rwlock_unlock(&fs->transaction_lock);
+    return res;
+}
+
+/* ( helper ) tells whether the transaction is due to commit : the commit interval is over,
+ * or it holds more leaf and index blocks than one operation can write (the next ones would soon have to wait for room) */
+int commit_due( sfs_context *fs ){
+    pthread_mutex_lock(&fs->journal_lock);
+    int due = fs->journal.buffer && ( fs->journal.num_of_blocks > JOURNAL_LEAF_BLOCKS || current_time() - fs->journal.last_commit >= COMMIT_INTERVAL );
+    pthread_mutex_unlock(&fs->journal_lock);
+    return due;
+}
+
+/* ( helper ) end of an operation (with no lock held) : commit the transaction if it is due */
+void commit_if_due( sfs_context *fs ){
+    if ( !commit_due(fs) ) return;
+    pthread_rwlock_wrlock(&fs->transaction_lock);
+    // unless another thread just did
+    if ( commit_due(fs) ) commit_transaction(fs);
+    pthread_rwlock_unlock(&fs->transaction_lock);
+}
+
+/* ( helper ) body of the committer thread of a volume : commit the transaction every commit interval, until the volume is unmounted
+ * (the operations commit it when they end, this one also commits it while the volume is idle) */
+void *committer( void *arg ){
+    sfs_context *fs = arg;
+    pthread_mutex_lock(&fs->committer_lock);
+    while ( !fs->committer_stop ) {
+        // sleep until the commit interval since the last commit is over (the operations may commit meanwhile)
+        pthread_mutex_lock(&fs->journal_lock);
+        long due = fs->journal.last_commit + COMMIT_INTERVAL;
+        pthread_mutex_unlock(&fs->journal_lock);
+        if ( current_time() < due ) {
+            struct timespec wake = { due / 1000, ( due % 1000 ) * 1000000 };
+            pthread_cond_timedwait(&fs->committer_wake, &fs->committer_lock, &wake);
+            continue;
+        }
+        pthread_mutex_unlock(&fs->committer_lock);
+        int failed = journal_commit(fs) == -1;
+        pthread_mutex_lock(&fs->committer_lock);
+        // a failed commit leaves the time of the last one behind, try again an interval later
+        if ( failed && !fs->committer_stop ) {
+            due = current_time() + COMMIT_INTERVAL;
+            struct timespec wake = { due / 1000, ( due % 1000 ) * 1000000 };
+            pthread_cond_timedwait(&fs->committer_wake, &fs->committer_lock, &wake);
+        }
+    }
+    pthread_mutex_unlock(&fs->committer_lock);
+    return NULL;
+}
+
+/* ( helper ) start the committer thread of a volume once it is mounted */
+void start_committer( sfs_context *fs ){
+    fs->committer_stop = 0;
+    if ( pthread_create(&fs->committer, NULL, committer, fs) ) {
+        // the operations still commit the transaction when they end
+        fprintf(stderr,"Error, could not start the committer of %s.\n", fs->image);
+        return;
+    }
+    fs->committer_running = 1;
+}
+
+/* ( helper ) stop the committer thread of a volume, and wait for it to end (with no lock held) */
+void stop_committer( sfs_context *fs ){
+    if ( !fs->committer_running ) return;
+    pthread_mutex_lock(&fs->committer_lock);
+    fs->committer_stop = 1;
+    pthread_cond_signal(&fs->committer_wake);
+    pthread_mutex_unlock(&fs->committer_lock);
+    pthread_join(fs->committer, NULL);
+    fs->committer_running = 0;
+}
+
+/* ( helper ) start of an operation writing length bytes (with no lock held) : commit the transaction if it may need the blocks it freed */
+void reclaim_pending_frees( sfs_context *fs, int length ){
+    pthread_mutex_lock(&fs->allocator_lock);
+    // the data blocks, plus a block for the extents
+    int reclaim = fs->journal.num_of_pending_frees && CEILING(length, BLOCK_SIZE) + 1 > NUM_OF_BLOCKS - fs->bit_map.size - fs->journal.num_of_pending_frees;
+    pthread_mutex_unlock(&fs->allocator_lock);
+    if ( reclaim ) journal_commit(fs);
+}
+
+/* ( helper ) number of leaf and index blocks an operation can write to the transaction while an open file (locked) grows to end bytes
+ * (the extents only leave the i-Node once they outnumber its slots, and each new block adds at most one extent) */
+int journal_room_needed( sfs_context *fs, int i_node_number, long end ){
+    i_node *file = &fs->i_node_table.i_nodes[i_node_number];
+    long num_of_extents = file->num_of_extents + MAX(0, CEILING(end, BLOCK_SIZE) - file->link_count);
+    if ( num_of_extents <= NUM_OF_INLINE_EXTENTS ) return 0;
+    return (int)MIN(JOURNAL_LEAF_BLOCKS, CEILING(num_of_extents, EXTENTS_PER_LEAF) + 1);
+}
+
+/* ( helper ) make room in the transaction for an operation that needs the given number of leaf and index blocks (with no lock held) :
+ * commit the transaction if it holds any, otherwise wait for the operations in progress to give back the room they set aside */
+void wait_journal_room( sfs_context *fs, int needed ){
+    pthread_mutex_lock(&fs->journal_lock);
+    int commit = fs->journal.num_of_blocks > 0;
+    while ( !commit && fs->journal.reserved + needed > JOURNAL_LEAF_ROOM ) pthread_cond_wait(&fs->journal_room, &fs->journal_lock);
+    pthread_mutex_unlock(&fs->journal_lock);
+    if ( commit ) journal_commit(fs);
+}
+
+/* ( helper ) write the transaction held by the journal in place again, if it committed (a crash may have cut its writes short) */
+void journal_replay( sfs_context *fs ){
+    journal_header *header = (journal_header *)fs->journal.buffer;
+    int *addresses = (int *)( fs->journal.buffer + sizeof(journal_header) );
+    char *blocks = fs->journal.buffer + JOURNAL_DESCRIPTOR_BLOCKS * BLOCK_SIZE;
+    read_blocks(&fs->disk, JOURNAL_ADDRESS, JOURNAL_DESCRIPTOR_BLOCKS, fs->journal.buffer);
+    int num_of_blocks = header->num_of_blocks;
+    // the journal is empty
+    if ( strcmp(header->magic, JOURNAL_MAGIC) || num_of_blocks < 1 || num_of_blocks > JOURNAL_CAPACITY ) return;
+    // or holds a transaction cut short by a crash (it never committed, and nothing of it was written in place)
+    read_blocks(&fs->disk, JOURNAL_ADDRESS + JOURNAL_DESCRIPTOR_BLOCKS, num_of_blocks, blocks);
+    if ( journal_checksum(fs->journal.buffer + sizeof(journal_header), (long)( JOURNAL_DESCRIPTOR_BLOCKS + num_of_blocks ) * BLOCK_SIZE - sizeof(journal_header)) != header->checksum ) return;
+    // write its blocks in place (the metadata tables, or leaf and index blocks in the data area)
+    for ( int i=0; i < num_of_blocks; i++ ) {
+        if ( addresses[i] < I_NODE_TABLE_ADDRESS || addresses[i] >= NUM_OF_BLOCKS || ( addresses[i] >= JOURNAL_ADDRESS && addresses[i] < DATA_BLOCKS_ADDRESS ) ) continue;
+        write_blocks(&fs->disk, addresses[i], 1, blocks + (long)i*BLOCK_SIZE);
+    }
+    fs->journal.sequence = header->sequence;
+    // the journal is empty once they are on the disk
+    sync_disk(&fs->disk);
+    memset(fs->journal.buffer, 0, BLOCK_SIZE);
+    write_blocks(&fs->disk, JOURNAL_ADDRESS, 1, fs->journal.buffer);
 }
 
 /* ( helper ) read the i-Node table to that is on the disk */
-void read_i_nodes( void ){
-    // buffer for the block
-    i_node i_node_table_block[I_NODE_TABLE_BLOCKS*BLOCK_SIZE];
-    // read the i-Node table from the disk to the buffer
-    read_blocks(I_NODE_TABLE_ADDRESS, I_NODE_TABLE_BLOCKS, &i_node_table_block);
-    // copy the i-Node table we just read into the one in memory
-    i_node_table.num_of_i_nodes = directory_table.num_of_dir;
-    for( int i = 0; i < MAX_FILES; i++ ){
-        i_node_table.i_nodes[i].mode = INACTIVE; // assume every file is closed
-        i_node_table.i_nodes[i].size = i_node_table_block[i].size;
-        i_node_table.i_nodes[i].link_count = i_node_table_block[i].link_count;
-        for( int j=0; j<NUM_OF_DIR_PTR; j++) i_node_table.i_nodes[i].direct_ptr[j] = i_node_table_block[i].direct_ptr[j];
-        i_node_table.i_nodes[i].indirect_ptr = i_node_table_block[i].indirect_ptr;
-    }
-}
-
-/* create an instance of the simple file system */
-void mksfs(int fresh){
-    // close any open disk
-    close_disk();
+void read_i_nodes( sfs_context *fs ){
+    // read the i-Node table from the disk
+    load_region(fs, &fs->i_node_region);
+    // the number of i-Nodes matches the number of directories
+    fs->i_node_table.num_of_i_nodes = fs->directory_table.num_of_dir;
+}
+
+/* ( helper ) tells whether the geometry in the super block can be laid out, return -1 if it can not */
+int check_geometry( sfs_context *fs ){
+    // the block size is a power of two, from the smallest block that holds the super block
+    if ( BLOCK_SIZE < MIN_BLOCK_SIZE || BLOCK_SIZE > MAX_BLOCK_SIZE || ( BLOCK_SIZE & (BLOCK_SIZE - 1) ) ) {
+        fprintf(stderr,"Error, invalid block size %d.\n", BLOCK_SIZE);
+        return -1;
+    }
+    // the root takes one i-Node, and the tables must fit in memory
+    if ( MAX_FILES < 2 || MAX_FILES > INT_MAX / (int)sizeof(i_node) ) {
+        fprintf(stderr,"Error, invalid number of files %d.\n", MAX_FILES);
+        return -1;
+    }
+    // the volume holds the tables, and at least one data block
+    if ( NUM_OF_BLOCKS > INT_MAX - BITS_PER_WORD || NUM_OF_BLOCKS <= DATA_BLOCKS_ADDRESS ) {
+        fprintf(stderr,"Error, invalid number of blocks %d.\n", NUM_OF_BLOCKS);
+        return -1;
+    }
+    return 0;
+}
+
+/* ( helper ) allocate the tables for the geometry in the super block and initialize them empty, return -1 on failure */
+int alloc_tables( sfs_context *fs ){
+    // the directory index has a power of two buckets, about two per file
+    for ( fs->directory_index.num_of_buckets = 1; fs->directory_index.num_of_buckets < 2 * MAX_FILES; fs->directory_index.num_of_buckets <<= 1 );
+    fs->i_node_table.i_nodes = calloc(MAX_FILES, sizeof(i_node));
+    fs->directory_table.directories = calloc(MAX_FILES, sizeof(directory_entry));
+    fs->bit_map.is_free = calloc(BITMAP_WORDS, sizeof(uint64_t));
+    fs->FDT.file_descriptors = calloc(MAX_DESCRIPTORS, sizeof(file_descriptor_entry));
+    fs->FDT.open_files = calloc(MAX_FILES, sizeof(open_file_entry));
+    fs->directory_index.heads = malloc(fs->directory_index.num_of_buckets * sizeof(int));
+    fs->directory_index.next = malloc(MAX_FILES * sizeof(int));
+    fs->reserved_blocks = calloc(BITMAP_WORDS, sizeof(uint64_t));
+    fs->journal.buffer = calloc(JOURNAL_BLOCKS, BLOCK_SIZE);
+    fs->journal.pending_frees = calloc(BITMAP_WORDS, sizeof(uint64_t));
+    fs->i_node_locks = malloc(MAX_FILES * sizeof(pthread_rwlock_t));
+    // the on-disk tables follow the super block, in this order
+    fs->i_node_region = (metadata_region){ fs->i_node_table.i_nodes, MAX_FILES * sizeof(i_node), I_NODE_TABLE_ADDRESS, I_NODE_TABLE_BLOCKS, calloc(I_NODE_TABLE_BLOCKS, 1) };
+    fs->bit_map_region = (metadata_region){ fs->bit_map.is_free, BITMAP_WORDS * sizeof(uint64_t), FREE_BITMAP_ADDRESS, FREE_BITMAP_BLOCKS, calloc(FREE_BITMAP_BLOCKS, 1) };
+    fs->directory_region = (metadata_region){ fs->directory_table.directories, MAX_FILES * sizeof(directory_entry), ROOT_DIRECTORY_ADDRESS, ROOT_DIRECTORY_BLOCKS, calloc(ROOT_DIRECTORY_BLOCKS, 1) };
+    if ( !fs->i_node_table.i_nodes || !fs->directory_table.directories || !fs->bit_map.is_free || !fs->FDT.file_descriptors || !fs->FDT.open_files || !fs->directory_index.heads
+         || !fs->directory_index.next || !fs->reserved_blocks || !fs->journal.buffer || !fs->journal.pending_frees || !fs->i_node_locks
+         || !fs->i_node_region.dirty || !fs->bit_map_region.dirty || !fs->directory_region.dirty ) {
+        fprintf(stderr,"Error, could not allocate the tables of a file system of %d blocks.\n", NUM_OF_BLOCKS);
+        free_tables(fs);
+        return -1;
+    }
 
     // initialize empty data structures
-    i_node_table.num_of_i_nodes = 0;
-    directory_table.num_of_dir = 0;
-    bit_map.size = 0;
-    FDT.num_of_files = 0;
+    fs->i_node_table.num_of_i_nodes = 0;
+    fs->directory_table.num_of_dir = 0;
+    fs->bit_map.size = 0;
+    fs->FDT.num_of_files = 0;
+    fs->journal.num_of_blocks = fs->journal.num_of_pending_frees = fs->journal.sequence = 0;
+    fs->journal.last_commit = current_time();
 
-    for (int i = 0; i < MAX_FILES; i++) {
-        // initialize the empty file descriptor
-        FDT.file_descriptors[i].i_node_number = -1;
-        FDT.file_descriptors[i].read_write_ptr = 0;
+    // initialize the empty file descriptors, all of them in the free list
+    for (int i = 0; i < MAX_DESCRIPTORS; i++) {
+        fs->FDT.file_descriptors[i].i_node_number = -1;
+        fs->FDT.file_descriptors[i].next_free = i + 1 < MAX_DESCRIPTORS ? i + 1 : -1;
+    }
+    fs->FDT.first_free = 0;
 
+    for (int i = 0; i < MAX_FILES; i++) {
         // initialize empty directory table
-        directory_table.directories[i].free = 1;
-        strcpy(directory_table.directories[i].filename, "\0");
+        fs->directory_table.directories[i].free = 1;
 
         // initialize empty i-Node table
-        i_node_table.i_nodes[i].mode = INACTIVE;
-        i_node_table.i_nodes[i].size = 0;
-        i_node_table.i_nodes[i].link_count = 0;
-        for(int j = 0; j < NUM_OF_DIR_PTR; j++) i_node_table.i_nodes[i].direct_ptr[j] = -1;
-        i_node_table.i_nodes[i].indirect_ptr = -1;
-        i_node_table.i_nodes[i].size = 0;
+        fs->i_node_table.i_nodes[i].mode = INACTIVE;
+        fs->i_node_table.i_nodes[i].extent_index = -1;
+        pthread_rwlock_init(&fs->i_node_locks[i], NULL);
     }
 
-    // initialize the free block list
-    for(int i=0; i <  NUM_OF_BLOCKS; i++ ) bit_map.is_free[i]=1;
+    // initialize the free block list (the padding bits past the last block are never free)
+    for(int i=0; i < BITMAP_WORDS; i++ ) fs->bit_map.is_free[i] = ~0ULL;
+    if ( NUM_OF_BLOCKS % BITS_PER_WORD ) fs->bit_map.is_free[BITMAP_WORDS-1] = ( 1ULL << (NUM_OF_BLOCKS % BITS_PER_WORD) ) - 1;
 
-    // in both cases we are pointing at the first file (skip the root)
-    current_file_index = 1;
-    dirs_iterated_over = 1;
-
-    // if we need to create a new file system
-    if ( fresh ) {
-        // create a fresh file system
-        init_fresh_disk("file_system.sfs", BLOCK_SIZE , NUM_OF_BLOCKS );
-
-        // fill it with empty blocks
-        void *empty_disk = malloc(BLOCK_SIZE * NUM_OF_BLOCKS );
-        write_blocks(0,NUM_OF_BLOCKS, empty_disk);
-        free( empty_disk );
-
-        // write every i-Node to the disk
-        for (int i = 0; i < MAX_FILES; i++) write_i_node(i);
-
-        // initialize the super block
-        strcpy(super_block.magic, MAGIC);
-        super_block.block_size = BLOCK_SIZE;
-        super_block.file_system_size = NUM_OF_BLOCKS;
-        super_block.i_node_table_length = MAX_FILES;
-        super_block.root = ROOT_DIRECTORY_ADDRESS;
-        // write it to the disk and mark the block as allocated
-        char super_blocks[BLOCK_SIZE] = {0};
-        memcpy(super_blocks, &super_block, sizeof(super_block_struct));
-        write_blocks(SUPER_BLOCK_ADDRESS, 1, &super_blocks);
-
-        // initialize the i-Node for the root directory and write it to the disk
-        i_node_table.i_nodes[0].mode= ROOT;
-        i_node_table.i_nodes[0].size = 0;
-        i_node_table.i_nodes[0].link_count = 1;
-        i_node_table.i_nodes[0].direct_ptr[0] = ROOT_DIRECTORY_ADDRESS;
-        i_node_table.num_of_i_nodes = 1;
-        // write the root's i-Node to the disk
-        write_i_node(0);
-
-        // initialize the directory table (only the root so far) and write it to the disk
-        directory_table.directories[0].free = 0;
-        strcpy(directory_table.directories[0].filename, "~\0");
-        directory_table.num_of_dir = 1;
-        char directory_blocks[ROOT_DIRECTORY_BLOCKS*BLOCK_SIZE] = {0};
-        memcpy(directory_blocks, &directory_table, sizeof(directory_table_struct));
-        write_blocks(ROOT_DIRECTORY_ADDRESS, ROOT_DIRECTORY_BLOCKS, &directory_blocks);
-
-        // flag the allocated blocks to the free bitmap
-        for(int i=0; i < DATA_BLOCKS_ADDRESS; i++ ){
-            bit_map.is_free[i]=0;
-            bit_map.size++;
-        }
-        // write it to the disk
-        char bit_map_blocks[FREE_BITMAP_BLOCKS*BLOCK_SIZE] = {0};
-        memcpy(bit_map_blocks, &bit_map, sizeof(bit_map_struct));
-        write_blocks(FREE_BITMAP_ADDRESS, FREE_BITMAP_BLOCKS, &bit_map_blocks );
+    // the allocator starts from the first data block
+    fs->alloc_cursor = DATA_BLOCKS_ADDRESS;
+    return 0;
+}
 
-    // if we are re-opening a previous file system
-    } else {
-        // re-open a previous file system
-        init_disk("file_system.sfs", BLOCK_SIZE , NUM_OF_BLOCKS);
+/* ( helper ) release the tables of the mounted file system (dropping the extent maps of the files left open) */
+void free_tables( sfs_context *fs ){
+    for ( int i = 0; fs->FDT.open_files && i < MAX_FILES; i++ ) free_extent_map(&fs->FDT.open_files[i].map);
+    for ( int i = 0; fs->i_node_locks && fs->i_node_table.i_nodes && i < MAX_FILES; i++ ) pthread_rwlock_destroy(&fs->i_node_locks[i]);
+    free(fs->i_node_locks);
+    fs->i_node_locks = NULL;
+    free(fs->i_node_table.i_nodes);
+    free(fs->directory_table.directories);
+    free(fs->bit_map.is_free);
+    free(fs->FDT.file_descriptors);
+    free(fs->FDT.open_files);
+    free(fs->directory_index.heads);
+    free(fs->directory_index.next);
+    free(fs->reserved_blocks);
+    free(fs->journal.buffer);
+    free(fs->journal.pending_frees);
+    free(fs->i_node_region.dirty);
+    free(fs->bit_map_region.dirty);
+    free(fs->directory_region.dirty);
+    memset(&fs->i_node_table, 0, sizeof(i_node_table_struct));
+    memset(&fs->directory_table, 0, sizeof(directory_table_struct));
+    memset(&fs->bit_map, 0, sizeof(bit_map_struct));
+    memset(&fs->FDT, 0, sizeof(FDT_struct));
+    memset(&fs->directory_index, 0, sizeof(directory_index_struct));
+    fs->reserved_blocks = NULL;
+    fs->read_maps = 0;
+    memset(&fs->journal, 0, sizeof(journal_struct));
+    memset(&fs->i_node_region, 0, sizeof(metadata_region));
+    memset(&fs->bit_map_region, 0, sizeof(metadata_region));
+    memset(&fs->directory_region, 0, sizeof(metadata_region));
+}
 
-        // read the super block from the disk and initialize it
-        //read_blocks(SUPER_BLOCK_ADDRESS, 1, &super_block);
-        char super_blocks[BLOCK_SIZE] = {0};
-        read_blocks(SUPER_BLOCK_ADDRESS, 1, &super_blocks);
-        memcpy(&super_block, super_blocks, sizeof(super_block_struct));
+/* ( helper ) commit the changes to the disk of a volume, then close it and release its cache and tables */
+void unmount_volume( sfs_context *fs ){
+    stop_committer(fs);
+    journal_commit(fs);
+    close_disk(&fs->disk);
+    cache_destroy(fs->cache);
+    fs->cache = NULL;
+    free_tables(fs);
+    memset(&fs->super_block, 0, sizeof(super_block_struct));
+}
 
-        // read the bitmap from the disk
-        //read_blocks(FREE_BITMAP_ADDRESS, FREE_BITMAP_BLOCKS, &bit_map);
-        char bit_map_blocks[FREE_BITMAP_BLOCKS*BLOCK_SIZE] = {0};
-        read_blocks(FREE_BITMAP_ADDRESS, FREE_BITMAP_BLOCKS, &bit_map_blocks);
-        memcpy(&bit_map, bit_map_blocks, sizeof(bit_map_struct));
+/* ( helper ) create a fresh file system with the given geometry on the disk file of a volume, return -1 on failure
+ * the geometry is recorded in the super block, so mounting lays the tables out the same way */
+int format_volume( sfs_context *fs, int block_size, int max_files, int num_of_blocks ){
+    // commit the changes to any open disk, then close it and release its tables
+    unmount_volume(fs);
 
-        // read the directory table from the disk
-        //read_blocks(ROOT_DIRECTORY_ADDRESS, ROOT_DIRECTORY_BLOCKS, &directory_table);
-        char directory_blocks[ROOT_DIRECTORY_BLOCKS*BLOCK_SIZE] = {0};
-        read_blocks(ROOT_DIRECTORY_ADDRESS, ROOT_DIRECTORY_BLOCKS, &directory_blocks);
-        memcpy(&directory_table, directory_blocks, sizeof(directory_table_struct));
+    // initialize the super block (the geometry macros read it from now on)
+    strcpy(fs->super_block.magic, MAGIC);
+    fs->super_block.block_size = block_size;
+    fs->super_block.file_system_size = num_of_blocks;
+    fs->super_block.i_node_table_length = max_files;
+    fs->super_block.root = ROOT_DIRECTORY_ADDRESS;
+    // lay out empty tables for this geometry
+    if ( check_geometry(fs) == -1 || alloc_tables(fs) == -1 ) {
+        memset(&fs->super_block, 0, sizeof(super_block_struct));
+        return -1;
+    }
 
-        // read the i-Node table from the disk
-        read_i_nodes();
+    // create a fresh file system (already filled with empty blocks, only the metadata needs to be written)
+    // and start with an empty cache
+    if ( init_fresh_disk(&fs->disk, fs->image, BLOCK_SIZE , NUM_OF_BLOCKS ) == -1
+         || !( fs->cache = cache_init(&fs->disk, BLOCK_SIZE, fs->cache_budget, fs->cache_mode) ) ) {
+        close_disk(&fs->disk);
+        free_tables(fs);
+        memset(&fs->super_block, 0, sizeof(super_block_struct));
+        return -1;
     }
+
+    // write the super block to the disk
+    char super_blocks[BLOCK_SIZE];
+    memset(super_blocks, 0, BLOCK_SIZE);
+    memcpy(super_blocks, &fs->super_block, sizeof(super_block_struct));
+    write_blocks(&fs->disk, SUPER_BLOCK_ADDRESS, 1, &super_blocks);
+
+    // initialize the i-Node for the root directory and write it to the disk
+    fs->i_node_table.i_nodes[0].mode= ROOT;
+    fs->i_node_table.i_nodes[0].size = 0;
+    fs->i_node_table.i_nodes[0].link_count = ROOT_DIRECTORY_BLOCKS;
+    fs->i_node_table.i_nodes[0].num_of_extents = 1;
+    fs->i_node_table.i_nodes[0].extents[0].start = ROOT_DIRECTORY_ADDRESS;
+    fs->i_node_table.i_nodes[0].extents[0].length = ROOT_DIRECTORY_BLOCKS;
+    fs->i_node_table.num_of_i_nodes = 1;
+
+    // initialize the directory table (only the root so far) and write it to the disk
+    fs->directory_table.directories[0].free = 0;
+    strcpy(fs->directory_table.directories[0].filename, "~\0");
+    fs->directory_table.num_of_dir = 1;
+
+    // flag the allocated blocks to the free bitmap
+    for(int i=0; i < DATA_BLOCKS_ADDRESS; i++ ) set_block_allocated(fs, i);
+
+    // write the whole i-Node table, bitmap and directory table to the disk (in place, the journal starts empty)
+    mark_dirty(fs, &fs->i_node_region, fs->i_node_region.table, fs->i_node_region.size);
+    mark_dirty(fs, &fs->bit_map_region, fs->bit_map_region.table, fs->bit_map_region.size);
+    mark_dirty(fs, &fs->directory_region, fs->directory_region.table, fs->directory_region.size);
+    flush_metadata(fs);
+
+    // index the root
+    build_dir_index(fs);
+    start_committer(fs);
+    return 0;
 }
 
-/* get the name of the next file in the directory */
-int sfs_getnextfilename(char *fname){
-    // get next file in the directory table
-    while( directory_table.directories[current_file_index].free ) current_file_index++;
-    ++dirs_iterated_over;
-    // if there are no more directories to list return 0 and reset the variables
-    if( dirs_iterated_over > directory_table.num_of_dir ) {
-            dirs_iterated_over=1;
-            current_file_index=1;
-            return 0;
-    }
-    // copy the name of the file into fname
-    strcpy(fname, directory_table.directories[current_file_index++].filename);
-    // if there are still files to list, return 1
-    return 1;
+/* ( helper ) mount the file system held by the disk file of a volume, return -1 on failure */
+int mount_volume( sfs_context *fs ){
+    // commit the changes to any open disk, then close it and release its tables
+    unmount_volume(fs);
+
+    // the geometry is not known yet : read the start of the super block as a block of the smallest size
+    char super_blocks[MIN_BLOCK_SIZE] = {0};
+    if ( init_disk(&fs->disk, fs->image, MIN_BLOCK_SIZE, 1) == -1 ) return -1;
+    read_blocks(&fs->disk, SUPER_BLOCK_ADDRESS, 1, &super_blocks);
+    close_disk(&fs->disk);
+    memcpy(&fs->super_block, super_blocks, sizeof(super_block_struct));
+
+    // refuse the disks that were formatted differently
+    if ( strcmp(fs->super_block.magic, MAGIC) || check_geometry(fs) == -1 || fs->super_block.root != ROOT_DIRECTORY_ADDRESS ) {
+        fprintf(stderr,"Error, %s is not a compatible file system (magic number %.15s).\n", fs->image, fs->super_block.magic);
+        memset(&fs->super_block, 0, sizeof(super_block_struct));
+        return -1;
+    }
+
+    // lay out the tables for the geometry of the disk
+    if ( alloc_tables(fs) == -1 ) {
+        memset(&fs->super_block, 0, sizeof(super_block_struct));
+        return -1;
+    }
+
+    // re-open the file system with its own geometry, and start with an empty cache
+    if ( init_disk(&fs->disk, fs->image, BLOCK_SIZE , NUM_OF_BLOCKS) == -1
+         || !( fs->cache = cache_init(&fs->disk, BLOCK_SIZE, fs->cache_budget, fs->cache_mode) ) ) {
+        close_disk(&fs->disk);
+        free_tables(fs);
+        memset(&fs->super_block, 0, sizeof(super_block_struct));
+        return -1;
+    }
+
+    // finish writing the last transaction, if a crash cut it short
+    journal_replay(fs);
+
+    // read the bitmap from the disk, and count the allocated blocks
+    load_region(fs, &fs->bit_map_region);
+    fs->bit_map.size = NUM_OF_BLOCKS;
+    for ( int i=0; i < BITMAP_WORDS; i++ ) fs->bit_map.size -= __builtin_popcountll(fs->bit_map.is_free[i]);
+
+    // read the directory table from the disk, and count the files (the root included)
+    load_region(fs, &fs->directory_region);
+    for ( int i=0; i < MAX_FILES; i++ ) fs->directory_table.num_of_dir += !fs->directory_table.directories[i].free;
+
+    // read the i-Node table from the disk
+    read_i_nodes(fs);
+
+    // index every file in the directory
+    build_dir_index(fs);
+    start_committer(fs);
+    return 0;
+}
+
+/* ( helper ) set up a volume over the given disk file, with nothing mounted yet, return -1 on failure */
+int init_context( sfs_context *fs, const char *image ){
+    memset(fs, 0, sizeof(sfs_context));
+    if ( !( fs->image = strdup(image) ) ) {
+        fprintf(stderr,"Error, could not allocate a volume for %s.\n", image);
+        return -1;
+    }
+    fs->disk.fd = -1;
+    fs->cache_budget = CACHE_SIZE;
+    fs->cache_mode = WRITE_BACK;
+    pthread_rwlock_init(&fs->transaction_lock, NULL);
+    pthread_rwlock_init(&fs->directory_lock, NULL);
+    pthread_mutex_init(&fs->FDT_lock, NULL);
+    pthread_mutex_init(&fs->allocator_lock, NULL);
+    pthread_mutex_init(&fs->journal_lock, NULL);
+    pthread_cond_init(&fs->journal_room, NULL);
+    // the committer sleeps on the same clock as current_time
+    pthread_condattr_t monotonic;
+    pthread_condattr_init(&monotonic);
+    pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
+    pthread_mutex_init(&fs->committer_lock, NULL);
+    pthread_cond_init(&fs->committer_wake, &monotonic);
+    pthread_condattr_destroy(&monotonic);
+    return 0;
+}
+
+/* ( helper ) unmount a volume and release everything it holds (but the context itself) */
+void destroy_context( sfs_context *fs ){
+    unmount_volume(fs);
+    pthread_rwlock_destroy(&fs->transaction_lock);
+    pthread_rwlock_destroy(&fs->directory_lock);
+    pthread_mutex_destroy(&fs->FDT_lock);
+    pthread_mutex_destroy(&fs->allocator_lock);
+    pthread_mutex_destroy(&fs->journal_lock);
+    pthread_cond_destroy(&fs->journal_room);
+    pthread_mutex_destroy(&fs->committer_lock);
+    pthread_cond_destroy(&fs->committer_wake);
+    free(fs->image);
+    fs->image = NULL;
+}
+
+/* mount the file system held by the given disk file, return its context (NULL on failure)
+ * every volume has its own tables, cache and locks, so volumes can be used from different threads at once */
+sfs_context *sfs_mount(const char *image){
+    sfs_context *fs = malloc(sizeof(sfs_context));
+    if ( !fs || init_context(fs, image) == -1 ) {
+        free(fs);
+        return NULL;
+    }
+    if ( mount_volume(fs) == -1 ) {
+        destroy_context(fs);
+        free(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+/* create a fresh file system in the given disk file with the given geometry : block size (in bytes), maximum number of files,
+ * and number of blocks, and mount it, return its context (NULL on failure) */
+sfs_context *sfs_mkfs(const char *image, int block_size, int max_files, int num_of_blocks){
+    sfs_context *fs = malloc(sizeof(sfs_context));
+    if ( !fs || init_context(fs, image) == -1 ) {
+        free(fs);
+        return NULL;
+    }
+    if ( format_volume(fs, block_size, max_files, num_of_blocks) == -1 ) {
+        destroy_context(fs);
+        free(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+/* commit the changes to the disk file of a volume and release its context (no other call may use it meanwhile, or after) */
+void sfs_unmount(sfs_context *fs){
+    destroy_context(fs);
+    free(fs);
+}
+
+/* set the memory budget (in bytes) and write policy (WRITE_BACK or WRITE_THROUGH) of the block cache of a volume */
+void sfs_ctx_cache_config(sfs_context *fs, int budget, int mode){
+    fs->cache_budget = budget;
+    fs->cache_mode = mode;
+    // (with no file system mounted, the next mount applies it)
+    if ( !fs->cache ) return;
+    // write what the current cache holds, and start over with the new configuration
+    cache_flush(fs->cache);
+    cache_destroy(fs->cache);
+    fs->cache = cache_init(&fs->disk, BLOCK_SIZE, fs->cache_budget, fs->cache_mode);
+}
+
+/* write the cached blocks of a volume to the disk file (the metadata changes wait for the next commit), return -1 on failure */
+int sfs_ctx_flush(sfs_context *fs){
+    // (with no file system mounted, nothing is cached)
+    if ( !fs->cache ) return 0;
+    return cache_flush(fs->cache) == -1 ? -1 : 0;
+}
+
+/* commit the metadata changes and write every cached block to the disk, and make everything written so far durable */
+int sfs_ctx_sync(sfs_context *fs){
+    return journal_commit(fs);
+}
+
+/* list up to max files of the directory, starting from the i-Node number given by the cookie
+ * return the number of entries filled (0 once every file is listed), by increasing i-Node number
+ * so the caller continues with the last i-Node number returned + 1 as the cookie */
+int sfs_ctx_readdir(sfs_context *fs, int cookie, readdir_entry *entries, int max){
+    int count = 0;
+    pthread_rwlock_rdlock(&fs->directory_lock);
+    // the root (i-Node 0) is not listed
+    for ( int i = MAX(cookie, 1); i < MAX_FILES && count < max; i++ ) {
+        // skip the free entries of the directory table
+        if ( fs->directory_table.directories[i].free ) continue;
+        strcpy(entries[count].filename, fs->directory_table.directories[i].filename);
+        entries[count].i_node_number = i;
+        pthread_rwlock_rdlock(&fs->i_node_locks[i]);
+        entries[count].size = fs->i_node_table.i_nodes[i].size;
+        pthread_rwlock_unlock(&fs->i_node_locks[i]);
+        count++;
+    }
+    pthread_rwlock_unlock(&fs->directory_lock);
+    return count;
 }
 
 /* get the size of the specified file */
-int sfs_getfilesize(const char *path){
+int sfs_ctx_getfilesize(sfs_context *fs, const char *path){
+    pthread_rwlock_rdlock(&fs->directory_lock);
     // get the index of the file in the directory table
-    int index = get_dir_index(path);
+    int index = get_dir_index(fs, path);
     // on failure, return -1
     if ( index == -1 ) {
+        pthread_rwlock_unlock(&fs->directory_lock);
         fprintf(stderr,"Error, file %s does not exists.\n", path);
         return -1;
     }
     // on success, return its size (index of dir table <=> i-Node number)
-    return i_node_table.i_nodes[index].size;
+    pthread_rwlock_rdlock(&fs->i_node_locks[index]);
+    int size = fs->i_node_table.i_nodes[index].size;
+    pthread_rwlock_unlock(&fs->i_node_locks[index]);
+    pthread_rwlock_unlock(&fs->directory_lock);
+    return size;
 }
 
-/* open the specified file in append mode, return the file descriptor
- * if the file does not exist, create a new file and sets its size to 0 */
-int sfs_fopen(char *fname){
-    // number of directories
-    int dirs = directory_table.num_of_dir;
-    // parse every file
-    for ( int i=0; i < MAX_FILES; i++ ){
-        // if this index is allocated
-        if ( !( directory_table.directories[i].free ) ) {
-            // if the file name matches the path
-            if( ! strcmp(fname, directory_table.directories[i].filename ) ){
-                // check if the file is already opened
-                int is_active = i_node_table.i_nodes[i].mode;
-                // if it is already opened, raise an error
-                if ( is_active ) {
-                    fprintf(stderr,"Error, file %s is already opened.\n", fname);
-                    return -1;
-                // otherwise, add it to the next available spot in the FDT and return its index
-                } else return create_FDT_entry(i);
-            }
-        }
-        // if no file in the directory matches the path, break the loop
-        if ( !(--dirs) ) break;
+/* find the i-Node number of the specified file, return -1 if it does not exist */
+int sfs_ctx_lookup(sfs_context *fs, const char *fname){
+    // the index in the directory table is the i-Node number
+    pthread_rwlock_rdlock(&fs->directory_lock);
+    int index = get_dir_index(fs, fname);
+    pthread_rwlock_unlock(&fs->directory_lock);
+    return index;
+}
+
+/* get the size of the file with the given i-Node number (and copy its name into fname unless it is NULL)
+ * return -1 if no file has this i-Node number */
+int sfs_ctx_getinode(sfs_context *fs, int i_node, char *fname){
+    int size = -1;
+    pthread_rwlock_rdlock(&fs->directory_lock);
+    // the root is not a file, and free entries hold no file
+    if ( i_node >= 1 && i_node < MAX_FILES && !fs->directory_table.directories[i_node].free ) {
+        if ( fname ) strcpy(fname, fs->directory_table.directories[i_node].filename);
+        pthread_rwlock_rdlock(&fs->i_node_locks[i_node]);
+        size = fs->i_node_table.i_nodes[i_node].size;
+        pthread_rwlock_unlock(&fs->i_node_locks[i_node]);
     }
+    pthread_rwlock_unlock(&fs->directory_lock);
+    return size;
+}
+
+/* ( helper ) open the file with the given i-Node number (with the transaction and directory locks held), return the file descriptor */
+int open_i_node(sfs_context *fs, int i_node){
+    pthread_rwlock_wrlock(&fs->i_node_locks[i_node]);
+    // add a descriptor to the next available spot in the FDT (the file may already be open under other ones)
+    int fd = create_FDT_entry(fs, i_node);
+    if ( fd == -1 ) fprintf(stderr,"Error, file %s could not be opened : too many open files.\n", fs->directory_table.directories[i_node].filename);
+    pthread_rwlock_unlock(&fs->i_node_locks[i_node]);
+    return fd;
+}
+
+/* ( helper ) create the specified file and open it (with the transaction lock, and the directory lock for writing, held)
+ * return the file descriptor */
+int create_file(sfs_context *fs, char *fname){
     // if we can't create a new file
-    if( (directory_table.num_of_dir) > MAX_FILES  ){
+    if( (fs->directory_table.num_of_dir) > MAX_FILES  ){
         fprintf(stderr,"Error, new file could not be created : file system capacity exceeded.\n");
         return -1;
     }
@@ -303,398 +1278,901 @@ int sfs_fopen(char *fname){
         return -1;
     }
     // next free directory table index, and i-Node number
-    int i_node_index= next_free_dir_entry();
+    int i_node_index= next_free_dir_entry(fs);
     // raise an error if we don't find free entries
     if ( i_node_index == -1 ) {
         fprintf(stderr,"Error, new file could not be created.\n");
         return -1;
     }
     // update the directory table
-    strcpy(directory_table.directories[i_node_index].filename, fname);
-    directory_table.directories[i_node_index].free = 0;
-    directory_table.num_of_dir++;
-    // write the updated directory table to the disk
-    char directory_blocks[ROOT_DIRECTORY_BLOCKS*BLOCK_SIZE] = {0};
-    memcpy(directory_blocks, &directory_table, sizeof(directory_table_struct));
-    write_blocks(ROOT_DIRECTORY_ADDRESS, ROOT_DIRECTORY_BLOCKS, (void *)directory_blocks);
-    // create a new i-Node at the next available spot
-    i_node_table.i_nodes[i_node_index].mode= ACTIVE;
-    i_node_table.i_nodes[i_node_index].size= 0;
-    i_node_table.i_nodes[i_node_index].link_count = 0;
-    i_node_table.num_of_i_nodes++;
-    // write the i-Node table to the disk
-    write_i_node(i_node_index);
-    // update the root's size, and cache it
-    i_node_table.i_nodes[0].size ++;
-    write_i_node(0);
+    strcpy(fs->directory_table.directories[i_node_index].filename, fname);
+    fs->directory_table.directories[i_node_index].free = 0;
+    fs->directory_table.num_of_dir++;
+    mark_dir_entry_dirty(fs, i_node_index);
+    dir_index_insert(fs, i_node_index);
+    // create a new i-Node at the next available spot (no other thread reaches it before the directory is unlocked)
+    fs->i_node_table.i_nodes[i_node_index].mode= INACTIVE;
+    fs->i_node_table.i_nodes[i_node_index].size= 0;
+    fs->i_node_table.i_nodes[i_node_index].link_count = 0;
+    fs->i_node_table.i_nodes[i_node_index].num_of_extents = 0;
+    fs->i_node_table.i_nodes[i_node_index].extent_index = -1;
+    fs->i_node_table.num_of_i_nodes++;
+    mark_i_node_dirty(fs, i_node_index);
+    // update the root's size
+    fs->i_node_table.i_nodes[0].size ++;
+    mark_i_node_dirty(fs, 0);
     // add it to the next available spot in the FDT and return its index
-    return create_FDT_entry(i_node_index);
+    return open_i_node(fs, i_node_index);
 }
 
-/* close the specified file (remove the entry from the open file descriptor table) */
-int sfs_fclose(int fileID) {
-    // i-Node number
-    int i_node = FDT.file_descriptors[fileID].i_node_number;
-    // if the file ID is invalid
-    if ( fileID < 0 || fileID >= MAX_FILES ) {
-        fprintf(stderr,"Error, invalid file ID %d.\n", fileID);
-        return -1;
+/* open the file with the given i-Node number in append mode, return the file descriptor */
+int sfs_ctx_fopeninode(sfs_context *fs, int i_node){
+    int fd = -1;
+    pthread_rwlock_rdlock(&fs->transaction_lock);
+    pthread_rwlock_rdlock(&fs->directory_lock);
+    // if no file has this i-Node number (the root is not a file, and free entries hold no file)
+    if ( i_node < 1 || i_node >= MAX_FILES || fs->directory_table.directories[i_node].free ) fprintf(stderr,"Error, no file has i-Node %d.\n", i_node);
+    // otherwise, open it
+    else fd = open_i_node(fs, i_node);
+    pthread_rwlock_unlock(&fs->directory_lock);
+    pthread_rwlock_unlock(&fs->transaction_lock);
+    return fd;
+}
+
+/* open the specified file in append mode, return the file descriptor
+ * if the file does not exist, create a new file and sets its size to 0 */
+int sfs_ctx_fopen(sfs_context *fs, char *fname){
+    int fd;
+    pthread_rwlock_rdlock(&fs->transaction_lock);
+    pthread_rwlock_rdlock(&fs->directory_lock);
+    // index of the file in the directory table (i.e. its i-Node number)
+    int index = get_dir_index(fs, fname);
+    // creating the file needs the directory to ourselves (another thread may create it meanwhile)
+    if ( index == -1 ) {
+        pthread_rwlock_unlock(&fs->directory_lock);
+        pthread_rwlock_wrlock(&fs->directory_lock);
+        index = get_dir_index(fs, fname);
     }
-    // if there isn't an open file associated to this ID
-    if ( !(FDT.num_of_files) || i_node == -1 ) {
-        fprintf(stderr,"Error, no open file is associated with file ID %d.\n", fileID);
-        return -1;
+    // if the file exists, open it by its i-Node number, otherwise create it
+    if ( index != -1 ) fd = open_i_node(fs, index);
+    else fd = create_file(fs, fname);
+    pthread_rwlock_unlock(&fs->directory_lock);
+    pthread_rwlock_unlock(&fs->transaction_lock);
+    // the new directory entry and i-Nodes reach the disk with the next commit
+    commit_if_due(fs);
+    return fd;
+}
+
+/* close the specified file (remove the entry from the open file descriptor table) */
+int sfs_ctx_fclose(sfs_context *fs, int fileID) {
+    // i-Node number (on failure, return -1)
+    int i_node = lock_file(fs, fileID, 1);
+    if ( i_node == -1 ) return -1;
+    // the last descriptor of the file drops its extent map (sfs_fwrite keeps the disk up to date) and its reservation
+    open_file_entry *file = &fs->FDT.open_files[i_node];
+    if ( --file->ref_count == 0 ) {
+        free_extent_map(&file->map);
+        pthread_mutex_lock(&fs->allocator_lock);
+        drop_reservation(fs, file);
+        pthread_mutex_unlock(&fs->allocator_lock);
     }
-    // if this file is opened, close it (set it as inactive) and write the i-Node to the disk
-    i_node_table.i_nodes[i_node].mode = INACTIVE;
-    write_i_node(i_node);
-    // remove this file from the FDT
-    FDT.file_descriptors[fileID].i_node_number = -1;
-    FDT.file_descriptors[fileID].read_write_ptr = 0;
-    FDT.num_of_files--;
+    // give the spot back to the FDT
+    pthread_mutex_lock(&fs->FDT_lock);
+    fs->FDT.file_descriptors[fileID].i_node_number = -1;
+    fs->FDT.file_descriptors[fileID].read_write_ptr = 0;
+    fs->FDT.file_descriptors[fileID].next_free = fs->FDT.first_free;
+    fs->FDT.first_free = fileID;
+    fs->FDT.num_of_files--;
+    pthread_mutex_unlock(&fs->FDT_lock);
+    unlock_file(fs, i_node, 1);
     // on success, return 0
     return 0;
 }
 
-/* ( helper function for sfs_fwrite ) write to the block at the given address and return the number of bytes written */
-int write_helper( int block_address, const char *write_buffer, char *block_buffer, int position_in_block, int remaining, int num_of_bytes_written){
-    // load the current block
-    read_blocks(block_address, 1, block_buffer);
-    // we write as many bytes as we can
-    int bytes_to_write =  MIN( (( !position_in_block ) ? BLOCK_SIZE : BLOCK_SIZE-position_in_block) , remaining);
+/* ( helper ) total length of a vector of buffers, -1 if the vector is invalid or holds more than a file can */
+int vector_length( const struct iovec *iov, int iovcnt ){
+    long length = 0;
+    if ( iovcnt < 0 || ( iovcnt && !iov ) ) return -1;
+    for ( int i=0; i < iovcnt; i++ ) {
+        length += iov[i].iov_len;
+        if ( length > INT_MAX ) return -1;
+    }
+    return (int)length;
+}
+
+/* ( helper ) take the next length bytes of a vector of buffers, from the given buffer and position in it (both move past them)
+ * return them in place if they lie in one buffer, otherwise gathered into scratch */
+const char *gather_bytes( const struct iovec *iov, int *index, size_t *position, int length, char *scratch ){
+    // skip the buffers we are done with
+    while ( *position == iov[*index].iov_len ) {
+        (*index)++;
+        *position = 0;
+    }
+    // if the bytes lie in the current buffer, hand them out as they are
+    if ( iov[*index].iov_len - *position >= (size_t)length ) {
+        *position += length;
+        return (const char *)iov[*index].iov_base + *position - length;
+    }
+    // otherwise copy them piece by piece
+    for ( int copied = 0; copied < length; ) {
+        while ( *position == iov[*index].iov_len ) {
+            (*index)++;
+            *position = 0;
+        }
+        int bytes = (int)MIN(iov[*index].iov_len - *position, (size_t)( length - copied ));
+        memcpy(scratch + copied, (const char *)iov[*index].iov_base + *position, bytes);
+        *position += bytes;
+        copied += bytes;
+    }
+    return scratch;
+}
+
+/* ( helper ) spread length bytes over a vector of buffers, from the given buffer and position in it (both move past them) */
+void scatter_bytes( const struct iovec *iov, int *index, size_t *position, const char *bytes, int length ){
+    for ( int copied = 0; copied < length; ) {
+        while ( *position == iov[*index].iov_len ) {
+            (*index)++;
+            *position = 0;
+        }
+        int n = (int)MIN(iov[*index].iov_len - *position, (size_t)( length - copied ));
+        memcpy((char *)iov[*index].iov_base + *position, bytes + copied, n);
+        *position += n;
+        copied += n;
+    }
+}
+
+/* ( helper function for sfs_fwrite ) write bytes_to_write bytes to the block at the given address from position_in_block (they fit in the block), return how many
+ * the block is only read first if we keep part of it (i.e. it is partially overwritten and was not just allocated) */
+int write_helper( sfs_context *fs, int block_address, const char *write_buffer, int position_in_block, int bytes_to_write, int is_new_block){
+    // if we overwrite the whole block, write it straight from buf
+    if ( bytes_to_write == BLOCK_SIZE ) {
+        cache_write_blocks(fs->cache, block_address, 1, (void *)write_buffer );
+        return bytes_to_write;
+    }
+    // otherwise start from the current block, or from zeros if it holds nothing worth keeping
+    char block_buffer[BLOCK_SIZE];
+    if ( is_new_block ) memset( block_buffer, 0, BLOCK_SIZE );
+    else cache_read_blocks(fs->cache, block_address, 1, block_buffer);
     // append buf from where we need to write in the current block
-    memcpy( block_buffer+position_in_block, write_buffer+num_of_bytes_written, bytes_to_write );
+    memcpy( block_buffer+position_in_block, write_buffer, bytes_to_write );
     // write the block to the disk
-    write_blocks( block_address, 1, block_buffer);
-    // free the buffer
-    free( block_buffer );
+    cache_write_blocks(fs->cache, block_address, 1, block_buffer);
     // return the number of bytes we just wrote
     return bytes_to_write;
 }
 
-/* write buffer characters onto an already opened file on the disk and return the number of bytes written */
-int sfs_fwrite(int fileID, const char *buf, int length) {
-    // number of bytes that have been read so far
-    int num_of_bytes_written = 0;
-    // if the file ID is invalid
-    if ( fileID < 0 || fileID >= MAX_FILES ) {
-        fprintf(stderr,"Error, invalid file ID %d.\n", fileID);
-        return 0;
+/* ( helper function for sfs_fwrite ) allocate a block at the end of an open file, return its address (-1 if the disk is full)
+ * the block comes from the file's reservation, renewed for the remaining blocks of the write when it runs out
+ * the extent map is updated in place, and written back by sfs_fwrite */
+int append_block( sfs_context *fs, int fileID, int remaining ){
+    i_node *file = &fs->i_node_table.i_nodes[fs->FDT.file_descriptors[fileID].i_node_number];
+    open_file_entry *entry = &fs->FDT.open_files[fs->FDT.file_descriptors[fileID].i_node_number];
+    pthread_mutex_lock(&fs->allocator_lock);
+    if ( !entry->reserved_length && reserve_blocks(fs, entry, file, remaining) == -1 ) {
+        pthread_mutex_unlock(&fs->allocator_lock);
+        return -1;
     }
-    // if the length is invalid
-    if ( length < 0 ) {
-        fprintf(stderr,"Error, invalid string length %d\n", length);
-        return 0;
+    // take the next block of the reservation, and set it as allocated in the free bitmap
+    int block_address = entry->reserved_start++;
+    entry->reserved_length--;
+    set_blocks_reserved(fs, block_address, 1, 0);
+    set_block_allocated(fs, block_address);
+    pthread_mutex_unlock(&fs->allocator_lock);
+    extent *extents = entry->map.extents;
+    int num = file->num_of_extents;
+    // if it follows the last block of the file on the disk, the last extent grows
+    if ( num && extents[num-1].start + extents[num-1].length == block_address ) {
+        extents[num-1].length++;
+        entry->map.first_dirty = MIN(entry->map.first_dirty, num-1);
+    // otherwise it starts a new extent
+    } else {
+        if ( add_extent_room(fs, &entry->map, file) == -1 ) {
+            pthread_mutex_lock(&fs->allocator_lock);
+            set_block_free(fs, block_address);
+            pthread_mutex_unlock(&fs->allocator_lock);
+            return -1;
+        }
+        extents = entry->map.extents;
+        extents[num].start = block_address;
+        extents[num].length = 1;
+        entry->map.first_blocks[num] = file->link_count;
+        entry->map.first_dirty = MIN(entry->map.first_dirty, num);
+        file->num_of_extents++;
     }
+    // update the i-Node link count
+    file->link_count++;
+    return block_address;
+}
+
+/* ( helper ) write buffer characters onto an open file (locked for writing) from the given position (at most its size)
+ * and return the number of bytes written */
+int write_file(sfs_context *fs, int fileID, const char *buf, int length, int write_from) {
+    struct iovec iov = { (void *)buf, length };
+    return write_file_v(fs, fileID, &iov, 1, write_from);
+}
+
+/* ( helper ) write a vector of buffers onto an open file (locked for writing) from the given position (at most its size)
+ * and return the number of bytes written, the blocks are mapped and the metadata updated once for the whole vector */
+int write_file_v(sfs_context *fs, int fileID, const struct iovec *iov, int iovcnt, int write_from) {
+    // number of bytes that have been written so far, and how many there are
+    int num_of_bytes_written = 0;
+    int length = vector_length(iov, iovcnt);
     // i-Node number
-    int i_node = FDT.file_descriptors[fileID].i_node_number;
-    // if there isn't an open file associated to this ID
-    if ( !(FDT.num_of_files) || i_node == -1 ) {
-        fprintf(stderr,"Error, no open file is associated with file ID %d.\n", fileID);
-        return 0;
-    }
-    // current size, position in file we write from, we write to
-    int curr_size = i_node_table.i_nodes[i_node].size;
-    int write_from = FDT.file_descriptors[fileID].read_write_ptr;
-    int write_to = write_from + length;
+    int i_node = fs->FDT.file_descriptors[fileID].i_node_number;
+    // current size
+    int curr_size = fs->i_node_table.i_nodes[i_node].size;
     // if we are trying to write past the maximum file size
-    if( write_to > MAX_FILE_SIZE ){
+    if( length > MAX_FILE_SIZE - write_from ){
         fprintf(stderr, "Error, seeking to write past the maximum file size.\n");
         return 0;
     }
-    // update the file's size if we need to increase it
-    i_node_table.i_nodes[i_node].size = MAX(write_to, curr_size);
-    // current number of blocks allocated to this i_Node, and number needed
-    int curr_num_of_blocks = i_node_table.i_nodes[i_node].link_count;
+    // extent map of the file
+    open_file_entry *entry = &fs->FDT.open_files[i_node];
     // pointer position relative to the current block
     int curr_block_index = write_from / BLOCK_SIZE  ;
     int position_in_block =  write_from % BLOCK_SIZE ;
     // if we need to write extra blocks but can't
-    if ( bit_map.size + CEILING (length - position_in_block , BLOCK_SIZE ) > NUM_OF_BLOCKS ) {
+    pthread_mutex_lock(&fs->allocator_lock);
+    int out_of_space = fs->bit_map.size + CEILING (length - position_in_block , BLOCK_SIZE ) > NUM_OF_BLOCKS;
+    pthread_mutex_unlock(&fs->allocator_lock);
+    if ( out_of_space ) {
         fprintf(stderr, "Error, seeking to write past maximal capacity of the file system.\n");
         return 0;
     }
-    // current block info
-    int block_address;
-    // while do not need extra blocks, write from the pointer ( we overwrite what's after if it's not at the end )
-    if( curr_block_index < curr_num_of_blocks ) {
-        // while/if the current block index is within the direct pointers scope
-        while ( curr_block_index < curr_num_of_blocks && num_of_bytes_written < length && curr_block_index < NUM_OF_DIR_PTR) {
-            // address of the current block
-            block_address = i_node_table.i_nodes[i_node].direct_ptr[curr_block_index++];
-            // write to the block and update the number of bytes written
-            num_of_bytes_written += write_helper(block_address, buf, malloc(BLOCK_SIZE), position_in_block,
-                                                 length - num_of_bytes_written, num_of_bytes_written);
-            // new position in block is at the start
-            position_in_block = 0;
-        }
-        // while we need to write, and the current block index is in the indirect pointer scope
-        if (curr_block_index < curr_num_of_blocks && num_of_bytes_written < length) {
-            // load the block of addresses pointed by the indirect pointer
-            int addresses[BLOCK_SIZE];
-            block_address = i_node_table.i_nodes[i_node].indirect_ptr;
-            read_blocks(block_address, 1, addresses);
-            // for every address it holds
-            for (int i = 0; i < (curr_num_of_blocks - NUM_OF_DIR_PTR); i++) {
-                // address of the current block
-                block_address = addresses[i];
-                // write to the block and update the number of bytes written
-                num_of_bytes_written += write_helper(block_address, buf, malloc(BLOCK_SIZE), position_in_block,
-                                                     length - num_of_bytes_written, num_of_bytes_written);
-                // new position in block is at the start
-                position_in_block = 0;
-                curr_block_index++;
-                // if we are done, break the loop
-                if (num_of_bytes_written >= length) break;
-            }
-        }
-    }
-    // if we need to write extra blocks ( we assume we have already written to the available blocks )
+    // current block info, and where the next bytes come from in the vector (gathered in a block when they span buffers)
+    int block_address, is_new_block, bytes_to_write;
+    int index = 0;
+    size_t position = 0;
+    char gathered[BLOCK_SIZE];
+    // write from the position ( we overwrite what's after if it's not at the end, and append new blocks past the end )
     while ( num_of_bytes_written < length ){
-        // get next available block
-        block_address = next_free_block();
-        // set as allocated in the free bitmap
-        bit_map.is_free[block_address] = 0;
-        bit_map.size ++;
+        // if the file already has this block, get its address from the extent map
+        is_new_block = curr_block_index >= fs->i_node_table.i_nodes[i_node].link_count;
+        if ( !is_new_block ) block_address = map_block(&entry->map, &fs->i_node_table.i_nodes[i_node], curr_block_index, NULL);
+        // otherwise append a new block to the file
+        else if ( ( block_address = append_block(fs, fileID, CEILING(write_from + length, BLOCK_SIZE) - curr_block_index) ) == -1 ) {
+            fprintf(stderr, "Error, the file system is full.\n");
+            break;
+        }
         // write to the block and update the number of bytes written
-        num_of_bytes_written += write_helper(block_address, buf, malloc(BLOCK_SIZE), position_in_block,
-                                             length - num_of_bytes_written, num_of_bytes_written);
+        bytes_to_write = MIN(BLOCK_SIZE - position_in_block, length - num_of_bytes_written);
+        num_of_bytes_written += write_helper(fs, block_address, gather_bytes(iov, &index, &position, bytes_to_write, gathered),
+                                             position_in_block, bytes_to_write, is_new_block);
         // new position in block is at the start
         position_in_block = 0;
-        // if we are in the indirect pointer scope
-        if( curr_block_index >= NUM_OF_DIR_PTR ){
-            // if we need to create a block of addresses
-            if ( i_node_table.i_nodes[i_node].indirect_ptr == -1 ) {
-                // get next available block
-                int ptr_block_address = next_free_block();
-                // set as allocated in the free bitmap
-                bit_map.is_free[ptr_block_address] = 0;
-                bit_map.size++;
-                // update the indirect pointer
-                i_node_table.i_nodes[i_node].indirect_ptr = ptr_block_address;
-                // write the indirect pointer block (empty for now)
-                void *empty_block = malloc(BLOCK_SIZE);
-                write_blocks(ptr_block_address, 1, empty_block);
-                free( empty_block );
-            }
-            // load the block of addresses pointed by the indirect pointer
-            int addresses[BLOCK_SIZE];
-            int ptr_block_address = i_node_table.i_nodes[i_node].indirect_ptr;
-            write_blocks(ptr_block_address, 1, addresses);
-            // append the current block number at the end
-            addresses[curr_block_index - NUM_OF_DIR_PTR] = block_address;
-            // write the updated block to the disk
-            write_blocks(ptr_block_address, 1, addresses);
-        } else { // if the current block index is within the direct pointers scope
-            // update the appropriate direct pointer
-            i_node_table.i_nodes[i_node].direct_ptr[curr_block_index] = block_address;
-        }
-        // update the i-Node link count and index
-        curr_block_index = ++(i_node_table.i_nodes[i_node].link_count);
+        curr_block_index++;
     }
-    // write the bitmap to the disk
-    char bit_map_blocks[FREE_BITMAP_BLOCKS*BLOCK_SIZE] = {0};
-    memcpy(bit_map_blocks,&bit_map, sizeof(bit_map_struct));
-    write_blocks(FREE_BITMAP_ADDRESS, FREE_BITMAP_BLOCKS, &bit_map_blocks );
-    // update the write pointer
-    FDT.file_descriptors[fileID].read_write_ptr = write_to;
+    // update the file's size if we need to increase it
+    fs->i_node_table.i_nodes[i_node].size = MAX(write_from + num_of_bytes_written, curr_size);
+    // write the extents we changed
+    store_extent_map(fs, &entry->map, &fs->i_node_table.i_nodes[i_node]);
+    // the i-Node and the bitmap blocks we changed reach the disk with the next commit
+    mark_i_node_dirty(fs, i_node);
     // return the number of bytes written
     return num_of_bytes_written;
 }
 
-/* read characters from the disk into the buffer */
-int sfs_fread(int fileID, char *buf, int length){
-    int num_of_bytes_read = 0;
-    // if the file ID is invalid
-    if ( fileID < 0 || fileID >= MAX_FILES ) {
-        fprintf(stderr,"Error, invalid file ID %d.\n", fileID);
+/* ( helper ) size of an open file, -1 if no file is open under this descriptor */
+int open_file_size(sfs_context *fs, int fileID){
+    int i_node = lock_file(fs, fileID, 0);
+    if ( i_node == -1 ) return -1;
+    int size = fs->i_node_table.i_nodes[i_node].size;
+    unlock_file(fs, i_node, 0);
+    return size;
+}
+
+/* ( helper ) tells whether the disk has room for an open file (locked) to grow to end bytes
+ * (the blocks freed by the transaction can not be reused before it commits) */
+int room_to_grow(sfs_context *fs, i_node *file, long end){
+    long needed = CEILING(end, BLOCK_SIZE) - file->link_count;
+    if ( needed <= 0 ) return 1;
+    pthread_mutex_lock(&fs->allocator_lock);
+    int room = needed <= NUM_OF_BLOCKS - fs->bit_map.size - fs->journal.num_of_pending_frees;
+    pthread_mutex_unlock(&fs->allocator_lock);
+    return room;
+}
+
+/* ( helper ) cut an open file (locked for writing) down to the given size, the blocks past it are released (their content is discarded) */
+void shrink_file(sfs_context *fs, int i_node_number, int size){
+    i_node *file = &fs->i_node_table.i_nodes[i_node_number];
+    open_file_entry *entry = &fs->FDT.open_files[i_node_number];
+    // the file grows back into the blocks, the reservation goes with them
+    pthread_mutex_lock(&fs->allocator_lock);
+    drop_reservation(fs, entry);
+    pthread_mutex_unlock(&fs->allocator_lock);
+    truncate_extent_map(fs, &entry->map, file, CEILING(size, BLOCK_SIZE));
+    file->size = size;
+    // the pointers can not stay past the end of the file (the descriptors of the file all hold its lock)
+    pthread_mutex_lock(&fs->FDT_lock);
+    for ( int i=0; i < MAX_DESCRIPTORS; i++ ) {
+        file_descriptor_entry *descriptor = &fs->FDT.file_descriptors[i];
+        if ( descriptor->i_node_number == i_node_number ) descriptor->read_write_ptr = MIN(descriptor->read_write_ptr, size);
+    }
+    pthread_mutex_unlock(&fs->FDT_lock);
+    // the updated i-Node and bitmap blocks reach the disk with the next commit
+    mark_i_node_dirty(fs, i_node_number);
+}
+
+/* ( helper ) make an open file (locked for writing) grow to the given size, it reads as 0's past its old end
+ * (the last block may hold bytes past it, and new blocks may hold stale data), return -1 if the disk is full
+ * (the file then keeps its size) */
+int grow_file(sfs_context *fs, int fileID, int size){
+    static const char zeros[16 * DEFAULT_BLOCK_SIZE];
+    int i_node_number = fs->FDT.file_descriptors[fileID].i_node_number;
+    i_node *file = &fs->i_node_table.i_nodes[i_node_number];
+    int old_size = file->size;
+    while ( file->size < size ) {
+        if ( !write_file(fs, fileID, zeros, MIN((int)sizeof(zeros), size - file->size), file->size) ) {
+            shrink_file(fs, i_node_number, old_size);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* write buffer characters onto an already opened file on the disk and return the number of bytes written */
+int sfs_ctx_fwrite(sfs_context *fs, int fileID, const char *buf, int length) {
+    struct iovec iov = { (void *)buf, MAX(length, 0) };
+    // if the length is invalid
+    if ( length < 0 ) {
+        fprintf(stderr,"Error, invalid string length %d\n", length);
         return 0;
     }
-    // i-Node number
-    int i_node = FDT.file_descriptors[fileID].i_node_number;
-    // if there isn't an open file associated to this ID
-    if ( !(FDT.num_of_files) || i_node == -1 ) {
-        fprintf(stderr,"Error, no open file is associated with file ID %d.\n", fileID);
+    return sfs_ctx_fwritev(fs, fileID, &iov, 1);
+}
+
+/* write a vector of buffers, one after the other, onto an already opened file and return the number of bytes written
+ * the blocks are mapped and allocated, and the metadata updated, once for the whole vector */
+int sfs_ctx_fwritev(sfs_context *fs, int fileID, const struct iovec *iov, int iovcnt) {
+    int length = vector_length(iov, iovcnt);
+    // if the vector is invalid
+    if ( length < 0 ) {
+        fprintf(stderr,"Error, invalid vector of %d buffers.\n", iovcnt);
         return 0;
     }
+    // the blocks freed since the last commit can only be reused once it is done
+    reclaim_pending_frees(fs, length);
+    // i-Node number (if there isn't an open file associated to this ID, nothing is written)
+    int i_node = lock_file_growing(fs, fileID, -1, length);
+    if ( i_node == -1 ) return 0;
+    file_descriptor_entry *entry = &fs->FDT.file_descriptors[fileID];
+    int num_of_bytes_written = write_file_v(fs, fileID, iov, iovcnt, entry->read_write_ptr);
+    // update the write pointer
+    entry->read_write_ptr += num_of_bytes_written;
+    unlock_file(fs, i_node, 1);
+    commit_if_due(fs);
+    // return the number of bytes written
+    return num_of_bytes_written;
+}
+
+/* write buffer characters onto an open file from the given offset, leaving the read/write pointer untouched
+ * a file written past its end reads as 0's in between, return the number of bytes written, -1 on failure */
+int sfs_ctx_pwrite(sfs_context *fs, int fileID, const char *buf, int length, int offset) {
+    struct iovec iov = { (void *)buf, MAX(length, 0) };
     // if the length is invalid
     if ( length < 0 ) {
-        fprintf(stderr,"Error, trying to read negative length.\n");
-        return 0;
+        fprintf(stderr,"Error, trying to write %d bytes at offset %d.\n", length, offset);
+        return -1;
+    }
+    return sfs_ctx_pwritev(fs, fileID, &iov, 1, offset);
+}
+
+/* write a vector of buffers, one after the other, onto an open file from the given offset, leaving the read/write pointer untouched
+ * a file written past its end reads as 0's in between, return the number of bytes written, -1 on failure */
+int sfs_ctx_pwritev(sfs_context *fs, int fileID, const struct iovec *iov, int iovcnt, int offset) {
+    int length = vector_length(iov, iovcnt);
+    // if the vector or offset is invalid
+    if ( length < 0 || offset < 0 || offset > MAX_FILE_SIZE ) {
+        fprintf(stderr,"Error, trying to write %d bytes at offset %d.\n", length, offset);
+        return -1;
+    }
+    // the blocks freed since the last commit can only be reused once it is done (the gap past the end of the file needs blocks too)
+    int size = open_file_size(fs, fileID);
+    if ( size == -1 ) return -1;
+    reclaim_pending_frees(fs, (int)MIN((long)length + MAX(0, offset - size), MAX_FILE_SIZE));
+    // i-Node number (on failure, return -1)
+    int i_node = lock_file_growing(fs, fileID, offset, length);
+    if ( i_node == -1 ) return -1;
+    // fill the gap past the end of the file, then write (a write that fails leaves the file as it was)
+    int num_of_bytes_written = 0;
+    size = fs->i_node_table.i_nodes[i_node].size;
+    if ( !room_to_grow(fs, &fs->i_node_table.i_nodes[i_node], (long)offset + length) ) fprintf(stderr, "Error, the file system is full.\n");
+    else if ( grow_file(fs, fileID, offset) == 0 ) {
+        num_of_bytes_written = write_file_v(fs, fileID, iov, iovcnt, offset);
+        if ( !num_of_bytes_written && fs->i_node_table.i_nodes[i_node].size > size ) shrink_file(fs, i_node, size);
     }
+    unlock_file(fs, i_node, 1);
+    commit_if_due(fs);
+    // return the number of bytes written
+    return num_of_bytes_written;
+}
+
+/* ( helper ) read up to length characters of an open file (locked) from the given position into the buffer
+ * and return the number of bytes read (0 past the end of the file) */
+int read_file(sfs_context *fs, int fileID, char *buf, int length, int read_from){
+    struct iovec iov = { buf, length };
+    return read_file_v(fs, fileID, &iov, 1, read_from);
+}
+
+/* ( helper ) read an open file (locked) from the given position into a vector of buffers, until they are full
+ * and return the number of bytes read (0 past the end of the file) */
+int read_file_v(sfs_context *fs, int fileID, const struct iovec *iov, int iovcnt, int read_from){
+    int num_of_bytes_read = 0;
+    int length = vector_length(iov, iovcnt);
+    // i-Node number
+    int i_node = fs->FDT.file_descriptors[fileID].i_node_number;
     // interval in which we read
-    int read_from = FDT.file_descriptors[fileID].read_write_ptr;
-    int end_of_file = i_node_table.i_nodes[i_node].size;
+    int end_of_file = fs->i_node_table.i_nodes[i_node].size;
     /* int read_to = MIN( end_of_file , read_from + length); */
     int reading_length = MIN( end_of_file - read_from , length );
-    // if the pointer is at the end of the file, nothing to read
-    if( read_from == end_of_file ) {
-        fprintf(stderr,"Error, pointer is already at the end of the file.\n");
-        return 0;
-    }
     // current block index and position of the pointer in it
     int curr_block_index =  read_from / BLOCK_SIZE ;
     int position_in_block = read_from % BLOCK_SIZE ;
-    // variables
-    char *block_buffer;
-    int bytes_to_read, block_address, *addresses;
-    // while we still need to load some blocks, and we don't are within direct pointers scope
-    while( (num_of_bytes_read < reading_length) && (curr_block_index < NUM_OF_DIR_PTR) ) {
-        // load the desired blocks
-        block_buffer = malloc(BLOCK_SIZE);
-        block_address = i_node_table.i_nodes[i_node].direct_ptr[curr_block_index++];
-        read_blocks( block_address, 1, block_buffer);
-        // we read as many bytes as we can
-        bytes_to_read =  MIN( (( !position_in_block ) ? BLOCK_SIZE : BLOCK_SIZE-position_in_block) , (reading_length-num_of_bytes_read) );
-        // save the content from the read pointer into buf
-        memcpy( buf+num_of_bytes_read , block_buffer+position_in_block, bytes_to_read);
-        // free the buffer, update the variables
-        position_in_block = 0;
-        num_of_bytes_read += bytes_to_read;
-        free(block_buffer);
-    }
-    // while we still need to load some blocks, and we are NOT within direct pointers scope
-    if( num_of_bytes_read < reading_length ) {
-        // load the block of addresses pointed by the indirect pointer
-        addresses = malloc(BLOCK_SIZE);
-        block_address = i_node_table.i_nodes[i_node].indirect_ptr;
-        read_blocks(block_address, 1, addresses);
-        // for every address it holds
-        while ( num_of_bytes_read < reading_length ) {
-            // address of the current block
-            block_address = addresses[curr_block_index++ - NUM_OF_DIR_PTR];
-            // load the desired blocks
-            block_buffer = malloc(BLOCK_SIZE);
-            read_blocks( block_address, 1, block_buffer);
+    // buffer for the partial blocks, and extent map of the file
+    char block_buffer[BLOCK_SIZE];
+    extent_map *map = &fs->FDT.open_files[i_node].map;
+    // variables, and where the next bytes go in the vector
+    int bytes_to_read, block_address, run, room;
+    int index = 0;
+    size_t position = 0;
+    // while we still need to load some blocks
+    while( num_of_bytes_read < reading_length ) {
+        // address of the current block, and number of blocks that follow it on the disk
+        block_address = map_block(map, &fs->i_node_table.i_nodes[i_node], curr_block_index, &run);
+        // room left in the current buffer
+        while ( position == iov[index].iov_len ) {
+            index++;
+            position = 0;
+        }
+        room = (int)MIN(iov[index].iov_len - position, (size_t)INT_MAX);
+        // if we only need part of the block (or it spans buffers), load it into the block buffer and copy what we need
+        if ( position_in_block || reading_length - num_of_bytes_read < BLOCK_SIZE || room < BLOCK_SIZE ) {
+            cache_read_blocks(fs->cache, block_address, 1, block_buffer);
             // we read as many bytes as we can
-            bytes_to_read =  MIN( (( !position_in_block ) ? BLOCK_SIZE : BLOCK_SIZE-position_in_block) , (reading_length-num_of_bytes_read) );
-            // save the content from the read pointer into buf
-            memcpy( buf+num_of_bytes_read , block_buffer+position_in_block, bytes_to_read);
-            // free the buffer, update the variables
+            bytes_to_read =  MIN( BLOCK_SIZE-position_in_block , (reading_length-num_of_bytes_read) );
+            // save the content from the read pointer into the buffers
+            scatter_bytes(iov, &index, &position, block_buffer+position_in_block, bytes_to_read);
             position_in_block = 0;
-            num_of_bytes_read += bytes_to_read;
-            free(block_buffer);
+            curr_block_index++;
+        // otherwise read the whole blocks that follow each other on the disk straight into the current buffer
+        } else {
+            int num_of_blocks = MIN(run, MIN(reading_length - num_of_bytes_read, room) / BLOCK_SIZE);
+            cache_read_blocks(fs->cache, block_address, num_of_blocks, (char *)iov[index].iov_base + position);
+            position += num_of_blocks * BLOCK_SIZE;
+            bytes_to_read = num_of_blocks*BLOCK_SIZE;
+            curr_block_index += num_of_blocks;
         }
-        // free the buffer
-        free(addresses);
+        // update the variables
+        num_of_bytes_read += bytes_to_read;
     }
+    // return the number of bytes read
+    return MAX(num_of_bytes_read, 0);
+}
+
+/* read characters from the disk into the buffer */
+int sfs_ctx_fread(sfs_context *fs, int fileID, char *buf, int length){
+    struct iovec iov = { buf, MAX(length, 0) };
+    // if the length is invalid
+    if ( length < 0 ) {
+        fprintf(stderr,"Error, trying to read negative length.\n");
+        return 0;
+    }
+    return sfs_ctx_freadv(fs, fileID, &iov, 1);
+}
+
+/* read an open file into a vector of buffers, filling one after the other, and return the number of bytes read */
+int sfs_ctx_freadv(sfs_context *fs, int fileID, const struct iovec *iov, int iovcnt){
+    // if the vector is invalid
+    if ( vector_length(iov, iovcnt) < 0 ) {
+        fprintf(stderr,"Error, invalid vector of %d buffers.\n", iovcnt);
+        return 0;
+    }
+    // i-Node number (if there isn't an open file associated to this ID, nothing is read)
+    int i_node = lock_file(fs, fileID, 0);
+    if ( i_node == -1 ) return 0;
+    // the readers of a file share its lock, the pointer goes with the FDT lock
+    pthread_mutex_lock(&fs->FDT_lock);
+    int read_from = fs->FDT.file_descriptors[fileID].read_write_ptr;
+    pthread_mutex_unlock(&fs->FDT_lock);
+    // if the pointer is at the end of the file, nothing to read
+    if( read_from == fs->i_node_table.i_nodes[i_node].size ) {
+        unlock_file(fs, i_node, 0);
+        fprintf(stderr,"Error, pointer is already at the end of the file.\n");
+        return 0;
+    }
+    int num_of_bytes_read = read_file_v(fs, fileID, iov, iovcnt, read_from);
     // update the read pointer
-    FDT.file_descriptors[fileID].read_write_ptr = read_from + num_of_bytes_read;
+    pthread_mutex_lock(&fs->FDT_lock);
+    fs->FDT.file_descriptors[fileID].read_write_ptr = read_from + num_of_bytes_read;
+    pthread_mutex_unlock(&fs->FDT_lock);
+    unlock_file(fs, i_node, 0);
     // return the number of bytes read
     return num_of_bytes_read;
 }
 
-/* seek (move the read/write pointer) to the specified location */
-int sfs_fseek(int fileID, int location){
-    // i-Node number
-    int i_node = FDT.file_descriptors[fileID].i_node_number;
-    // if the file ID is invalid
-    if ( fileID < 0 || fileID >= MAX_FILES ) {
-        fprintf(stderr,"Error, invalid file ID %d.\n", fileID);
+/* read up to length characters of an open file from the given offset into the buffer, leaving the read/write pointer untouched
+ * return the number of bytes read (0 past the end of the file), -1 on failure */
+int sfs_ctx_pread(sfs_context *fs, int fileID, char *buf, int length, int offset){
+    struct iovec iov = { buf, MAX(length, 0) };
+    // if the length is invalid
+    if ( length < 0 ) {
+        fprintf(stderr,"Error, trying to read %d bytes at offset %d.\n", length, offset);
         return -1;
     }
-    // if there isn't an open file associated to this ID
-    if (  !(FDT.num_of_files) || i_node == -1 ) {
-        fprintf(stderr,"Error, no open file is associated with file ID %d.\n", fileID);
+    return sfs_ctx_preadv(fs, fileID, &iov, 1, offset);
+}
+
+/* read an open file from the given offset into a vector of buffers, filling one after the other, leaving the read/write pointer untouched
+ * return the number of bytes read (0 past the end of the file), -1 on failure */
+int sfs_ctx_preadv(sfs_context *fs, int fileID, const struct iovec *iov, int iovcnt, int offset){
+    int length = vector_length(iov, iovcnt);
+    // if the vector or offset is invalid
+    if ( length < 0 || offset < 0 ) {
+        fprintf(stderr,"Error, trying to read %d bytes at offset %d.\n", length, offset);
         return -1;
     }
-    // if the location exceeds the boundary
-    if ( location < 0 || i_node_table.i_nodes[i_node].size < location ) {
+    // i-Node number (on failure, return -1)
+    int i_node = lock_file(fs, fileID, 0);
+    if ( i_node == -1 ) return -1;
+    int num_of_bytes_read = read_file_v(fs, fileID, iov, iovcnt, offset);
+    unlock_file(fs, i_node, 0);
+    return num_of_bytes_read;
+}
+
+/* seek (move the read/write pointer) to the specified location */
+int sfs_ctx_fseek(sfs_context *fs, int fileID, int location){
+    int res = 0;
+    // i-Node number (on failure, return -1)
+    int i_node = lock_file(fs, fileID, 0);
+    if ( i_node == -1 ) return -1;
+    // if the location exceeds the boundary, the pointer goes to the end of the file
+    if ( location < 0 || fs->i_node_table.i_nodes[i_node].size < location ) {
         fprintf(stderr,"Error, location exceeds boundaries of file %d.\n", fileID);
-        FDT.file_descriptors[fileID].read_write_ptr = i_node_table.i_nodes[FDT.file_descriptors[fileID].i_node_number].size;
+        location = fs->i_node_table.i_nodes[i_node].size;
+        res = -1;
+    }
+    // otherwise, move the pointer to the location (a file never grows past the maximum file size)
+    // (the readers of a file share its lock, the pointer goes with the FDT lock)
+    pthread_mutex_lock(&fs->FDT_lock);
+    fs->FDT.file_descriptors[fileID].read_write_ptr = location;
+    pthread_mutex_unlock(&fs->FDT_lock);
+    unlock_file(fs, i_node, 0);
+    // on success, return 0
+    return res;
+}
+
+/* change the size of an open file in place, return 0 on success
+ * the blocks past the new end are released, and a file that grows reads as 0's past its old end */
+int sfs_ctx_ftruncate(sfs_context *fs, int fileID, int size){
+    // if the size is invalid
+    if ( size < 0 || size > MAX_FILE_SIZE ) {
+        fprintf(stderr,"Error, invalid file size %d.\n", size);
         return -1;
     }
-    // if we are trying to seek past the maximum file size
-    if( location > MAX_FILE_SIZE ){
-        fprintf(stderr, "Error, seeking location past the maximum file size.\n");
-        return 0;
+    // the blocks freed since the last commit can only be reused once it is done (when growing)
+    int old_size = open_file_size(fs, fileID);
+    if ( old_size == -1 ) return -1;
+    if ( size > old_size ) reclaim_pending_frees(fs, size - old_size);
+    // i-Node number (on failure, return -1)
+    int i_node_number = lock_file_growing(fs, fileID, size, 0);
+    if ( i_node_number == -1 ) return -1;
+    i_node *file = &fs->i_node_table.i_nodes[i_node_number];
+    int res = 0;
+    // growing : write 0's from the old end (a file the disk can not hold keeps its size)
+    if ( size > file->size ) {
+        if ( room_to_grow(fs, file, size) ) res = grow_file(fs, fileID, size);
+        else {
+            fprintf(stderr, "Error, the file system is full.\n");
+            res = -1;
+        }
+    // shrinking : release the blocks past the new end
+    } else shrink_file(fs, i_node_number, size);
+    unlock_file(fs, i_node_number, 1);
+    commit_if_due(fs);
+    return res;
+}
+
+/* map a range of an open file onto the disk file, return the number of extents filled (at most max_extents)
+ * the range is cut at the end of the file when reading, and the cached blocks it covers are written back first,
+ * the caller then copies the data out and calls sfs_fmap_release (until then, the blocks the files give back are not reused)
+ * when writing, a gap past the end of the file is filled with 0's and the blocks the range needs are allocated,
+ * the caller then copies the data in and calls sfs_fmap_done, the file stays locked until then (unless this returns -1)
+ * (the read/write pointer is left untouched) */
+int sfs_ctx_fmap(sfs_context *fs, int fileID, int offset, int length, int writing, file_extent *extents, int max_extents){
+    // the blocks freed since the last commit can only be reused once it is done
+    if ( writing ) reclaim_pending_frees(fs, length);
+    // i-Node number (on failure, return -1)
+    int i_node = writing ? lock_file_growing(fs, fileID, offset, length) : lock_file(fs, fileID, 0);
+    if ( i_node == -1 ) return -1;
+    open_file_entry *entry = &fs->FDT.open_files[i_node];
+    int size = fs->i_node_table.i_nodes[i_node].size;
+    // when reading, only the bytes of the file are mapped
+    if ( !writing ) length = MIN(length, MAX(0, size - offset));
+    if ( offset < 0 || length < 0 ) {
+        unlock_file(fs, i_node, writing);
+        fprintf(stderr,"Error, range exceeds boundaries of file %d.\n", fileID);
+        return -1;
     }
-    // otherwise, move the pointers to the location
-    FDT.file_descriptors[fileID].read_write_ptr = location;
-    // on success, return 0
+    // when writing, allocate the blocks past the end of the file (the range stops short if the disk is full)
+    if ( writing ) {
+        if( length > MAX_FILE_SIZE - offset ){
+            unlock_file(fs, i_node, writing);
+            fprintf(stderr, "Error, seeking to write past the maximum file size.\n");
+            return -1;
+        }
+        // fill the gap past the end of the file, as sfs_pwrite does (nothing is mapped if the disk is full)
+        if ( grow_file(fs, fileID, offset) == -1 ) length = 0;
+        while ( fs->i_node_table.i_nodes[i_node].link_count < CEILING(offset + length, BLOCK_SIZE) ) {
+            if ( append_block(fs, fileID, CEILING(offset + length, BLOCK_SIZE) - fs->i_node_table.i_nodes[i_node].link_count) == -1 ) {
+                fprintf(stderr, "Error, the file system is full.\n");
+                length = MAX(0, fs->i_node_table.i_nodes[i_node].link_count * BLOCK_SIZE - offset);
+                break;
+            }
+        }
+    }
+    // one extent per run of consecutive blocks
+    int count = 0, position = offset, end = offset + length;
+    while ( position < end && count < max_extents ) {
+        int first = position / BLOCK_SIZE, run;
+        int address = map_block(&entry->map, &fs->i_node_table.i_nodes[i_node], first, &run);
+        run = MIN(run, CEILING(end, BLOCK_SIZE) - first);
+        int run_end = MIN(end, ( first + run ) * BLOCK_SIZE);
+        // the disk must hold the latest content of the run, and the cache must not keep copies the caller overwrites
+        cache_write_back(fs->cache, address, run);
+        if ( writing ) cache_invalidate(fs->cache, address, run);
+        extents[count].disk_offset = (long)address * BLOCK_SIZE + position % BLOCK_SIZE;
+        extents[count].length = run_end - position;
+        count++;
+        position = run_end;
+    }
+    // when writing, the file only grows once the caller has copied the data in (sfs_fmap_done)
+    if ( writing ) {
+        pthread_mutex_lock(&fs->FDT_lock);
+        entry->mapped = 1;
+        entry->map_descriptor = fileID;
+        entry->map_offset = offset;
+        entry->map_length = position - offset;
+        entry->map_size = size;
+        pthread_mutex_unlock(&fs->FDT_lock);
+    }
+    else {
+        pthread_mutex_lock(&fs->allocator_lock);
+        fs->read_maps++;
+        pthread_mutex_unlock(&fs->allocator_lock);
+        unlock_file(fs, i_node, writing);
+    }
+    return count;
+}
+
+/* finish a write mapped by sfs_fmap from offset through the same descriptor, once the caller has copied the given number of bytes in
+ * the file grows to cover the bytes actually written (the blocks allocated past them are released, and a file with nothing written
+ * keeps its size), the cache drops its copies of the blocks the caller wrote, and the file is unlocked
+ * return -1 if no such write is mapped (nothing is unlocked then) */
+int sfs_ctx_fmap_done(sfs_context *fs, int fileID, int offset, int written){
+    if ( fileID < 0 || fileID >= MAX_DESCRIPTORS ) {
+        fprintf(stderr,"Error, invalid file ID %d.\n", fileID);
+        return -1;
+    }
+    // i-Node number (sfs_fmap left the file locked, so it is still open under this descriptor), and the write it mapped
+    pthread_mutex_lock(&fs->FDT_lock);
+    int i_node_number = fs->FDT.file_descriptors[fileID].i_node_number;
+    open_file_entry *entry = ( i_node_number == -1 ) ? NULL : &fs->FDT.open_files[i_node_number];
+    int mapped = entry && entry->mapped && entry->map_descriptor == fileID && entry->map_offset == offset;
+    if ( mapped ) entry->mapped = 0;
+    pthread_mutex_unlock(&fs->FDT_lock);
+    if ( !mapped ) {
+        fprintf(stderr,"Error, no write is mapped from offset %d through file ID %d.\n", offset, fileID);
+        return -1;
+    }
+    i_node *file = &fs->i_node_table.i_nodes[i_node_number];
+    // (at most the mapped bytes were written)
+    written = MAX(0, MIN(written, entry->map_length));
+    // the copies of the written blocks the cache may have taken meanwhile are older than the disk
+    for ( int block = offset / BLOCK_SIZE, run; block < CEILING(offset + written, BLOCK_SIZE); block += run ) {
+        int address = map_block(&entry->map, file, block, &run);
+        run = MIN(run, CEILING(offset + written, BLOCK_SIZE) - block);
+        cache_invalidate(fs->cache, address, run);
+    }
+    // the file covers the bytes written, and gives back the blocks allocated for the ones that were not
+    // (with nothing written, the gap sfs_fmap filled goes too)
+    file->size = written ? MAX(file->size, offset + written) : entry->map_size;
+    if ( file->link_count > CEILING(file->size, BLOCK_SIZE) ) shrink_file(fs, i_node_number, file->size);
+    else {
+        store_extent_map(fs, &entry->map, file);
+        // the updated i-Node and bitmap blocks reach the disk with the next commit
+        mark_i_node_dirty(fs, i_node_number);
+    }
+    unlock_file(fs, i_node_number, 1);
+    commit_if_due(fs);
     return 0;
 }
 
+/* finish a read mapped by sfs_fmap, once the caller has copied the data out */
+void sfs_ctx_fmap_release(sfs_context *fs){
+    pthread_mutex_lock(&fs->allocator_lock);
+    if ( fs->read_maps > 0 ) fs->read_maps--;
+    pthread_mutex_unlock(&fs->allocator_lock);
+}
+
 /* remove a file from the file system (release the data blocks, i-Node, directory entry, etc.) */
-int sfs_remove(char *file){
+int sfs_ctx_remove(sfs_context *fs, char *file){
+    pthread_rwlock_rdlock(&fs->transaction_lock);
+    pthread_rwlock_wrlock(&fs->directory_lock);
     // index of the file in the directory table (i.e. its i-Node number)
-    int i_node_index = get_dir_index(file);
+    int i_node_index = get_dir_index(fs, file);
     // if no such file exists, return -1
     if ( i_node_index == -1 ) {
+        pthread_rwlock_unlock(&fs->directory_lock);
+        pthread_rwlock_unlock(&fs->transaction_lock);
         fprintf(stderr,"Error, file %s does not exists.\n", file);
         return -1;
     }
+    pthread_rwlock_wrlock(&fs->i_node_locks[i_node_index]);
     // if the file is opened, we need to close it first
-    if ( i_node_table.i_nodes[i_node_index].mode ) {
-        fprintf(stderr,"Error, file must be closed before being removed.\n");
-        return -1;
+    // otherwise, release the data blocks used by the file, and the blocks holding its extents
+    // (their content is discarded, not overwritten)
+    extent_map map = { 0 };
+    int res = -1;
+    if ( fs->FDT.open_files[i_node_index].ref_count ) fprintf(stderr,"Error, file must be closed before being removed.\n");
+    else if ( load_extent_map(fs, &map, i_node_index) != -1 ) {
+        truncate_extent_map(fs, &map, &fs->i_node_table.i_nodes[i_node_index], 0);
+        free_extent_map(&map);
+        // free the i-Node
+        fs->i_node_table.i_nodes[i_node_index].mode = INACTIVE;
+        fs->i_node_table.i_nodes[i_node_index].size = 0;
+        fs->i_node_table.num_of_i_nodes--;
+        mark_i_node_dirty(fs, i_node_index);
+        // remove the file from the directory entry (and from the index, while it still has its name)
+        dir_index_remove(fs, i_node_index);
+        fs->directory_table.directories[i_node_index].free = 1;
+        strcpy(fs->directory_table.directories[i_node_index].filename, "\0");
+        fs->directory_table.num_of_dir--;
+        mark_dir_entry_dirty(fs, i_node_index);
+        res = 0;
     }
-    // otherwise, release the data blocks used by the file
-    int block_address;
-    int num_of_blocks = i_node_table.i_nodes[i_node_index].link_count;
-    // free all the blocks that it uses
-    for( int i=0; i < NUM_OF_DIR_PTR; i++){
-        if ( i >= num_of_blocks ) break;
-        // block number and address
-        block_address = i_node_table.i_nodes[i_node_index].direct_ptr[i];
-        // free it from the bitmap
-        bit_map.is_free[block_address] = 1;
-        bit_map.size--;
-        // update the i-Node direct pointer
-        i_node_table.i_nodes[i_node_index].direct_ptr[i] = -1;
-        // overwrite the current block
-        void *empty_block = malloc(BLOCK_SIZE);
-        write_blocks(block_address, 1, empty_block);
-        free( empty_block );
-    }
-    // free the blocks pointed by the indirect pointer if needed
-    if ( num_of_blocks > NUM_OF_DIR_PTR  ){
-        // block of indirect pointer number and address
-        int ptr_block_address = i_node_table.i_nodes[i_node_index].indirect_ptr;
-        // load the adresses
-        int addresses[BLOCK_SIZE];
-        read_blocks(ptr_block_address, 1, addresses);
-        for( int i=0; i < (num_of_blocks-NUM_OF_DIR_PTR); i++){
-            // block number and address
-            block_address = addresses[i];
-            // free it from the bitmap
-            bit_map.is_free[block_address] = 1;
-            bit_map.size--;
-            // overwrite the current block
-            void *empty_block = malloc(BLOCK_SIZE);
-            write_blocks(block_address, 1, empty_block);
-            free( empty_block );
-        }
-        // update the i-Node indirect pointer
-        i_node_table.i_nodes[i_node_index].indirect_ptr = -1;
-        // overwrite the pointer block
-        void *empty_block = malloc(BLOCK_SIZE);
-        write_blocks(ptr_block_address, 1, empty_block);
-        free( empty_block );
-        // free the pointer block from the bitmap
-        bit_map.is_free[ptr_block_address] = 1;
-        bit_map.size--;
-    }
-    // free the i-Node
-    i_node_table.i_nodes[i_node_index].mode = INACTIVE;
-    i_node_table.i_nodes[i_node_index].size = 0;
-    i_node_table.i_nodes[i_node_index].link_count = 0;
-    i_node_table.i_nodes[i_node_index].indirect_ptr = -1;
-    i_node_table.num_of_i_nodes--;
-    // write the i-Node table to the disk
-    write_i_node(i_node_index);
-    // remove the file from the directory entry
-    directory_table.directories[i_node_index].free = 1;
-    strcpy(directory_table.directories[i_node_index].filename, "\0");
-    directory_table.num_of_dir--;
-    // write the updated directory table to the disk
-    char directory_blocks[ROOT_DIRECTORY_BLOCKS*BLOCK_SIZE] = {0};
-    memcpy(directory_blocks, &directory_table, sizeof(directory_table_struct));
-    write_blocks(ROOT_DIRECTORY_ADDRESS, ROOT_DIRECTORY_BLOCKS, &directory_blocks);
-    // write the updated free block bit map to the disk
-    char bit_map_blocks[FREE_BITMAP_BLOCKS*BLOCK_SIZE] = {0};
-    memcpy(bit_map_blocks,&bit_map, sizeof(bit_map_struct));
-    write_blocks(FREE_BITMAP_ADDRESS, FREE_BITMAP_BLOCKS, &bit_map_blocks );
+    pthread_rwlock_unlock(&fs->i_node_locks[i_node_index]);
+    pthread_rwlock_unlock(&fs->directory_lock);
+    pthread_rwlock_unlock(&fs->transaction_lock);
+    // the updated i-Node, directory entry and bitmap blocks reach the disk with the next commit
+    commit_if_due(fs);
     // on success, return 0
-    return 0;
+    return res;
+}
+
+/* ( helper ) set up the default volume, over DEFAULT_IMAGE */
+void init_default_volume( void ){
+    init_context(&default_volume, DEFAULT_IMAGE);
+}
+
+/* get the volume the API functions without a context work on (nothing is mounted before mksfs) */
+sfs_context *sfs_default_context(void){
+    pthread_once(&default_volume_once, init_default_volume);
+    return &default_volume;
+}
+
+/* create an instance of the simple file system (on DEFAULT_IMAGE)
+ * a fresh one gets the default geometry, otherwise the existing one is mounted */
+void mksfs(int fresh){
+    if ( fresh ) format_volume(sfs_default_context(), DEFAULT_BLOCK_SIZE, DEFAULT_MAX_FILES, DEFAULT_NUM_OF_BLOCKS);
+    else mount_volume(sfs_default_context());
+    // we are pointing at the first file (skip the root)
+    current_file_index = 1;
+}
+
+/* create a fresh file system on DEFAULT_IMAGE with the given geometry, return -1 on failure */
+int sfs_format(int block_size, int max_files, int num_of_blocks){
+    current_file_index = 1;
+    return format_volume(sfs_default_context(), block_size, max_files, num_of_blocks);
+}
+
+/* the API functions below work on the default volume */
+void sfs_cache_config(int budget, int mode){
+    sfs_ctx_cache_config(sfs_default_context(), budget, mode);
+}
+
+int sfs_flush(void){
+    return sfs_ctx_flush(sfs_default_context());
+}
+
+int sfs_sync(void){
+    return sfs_ctx_sync(sfs_default_context());
+}
+
+int sfs_readdir(int cookie, readdir_entry *entries, int max){
+    return sfs_ctx_readdir(sfs_default_context(), cookie, entries, max);
+}
+
+/* get the name of the next file in the directory */
+int sfs_getnextfilename(char *fname){
+    readdir_entry entry;
+    // if there are no more files to list return 0, and start over on the next call
+    if ( !sfs_readdir(current_file_index, &entry, 1) ) {
+        current_file_index = 1;
+        return 0;
+    }
+    // copy the name of the file into fname, the next call starts after it
+    strcpy(fname, entry.filename);
+    current_file_index = entry.i_node_number + 1;
+    // if there are still files to list, return 1
+    return 1;
+}
+
+int sfs_getfilesize(const char *path){
+    return sfs_ctx_getfilesize(sfs_default_context(), path);
+}
+
+int sfs_lookup(const char *fname){
+    return sfs_ctx_lookup(sfs_default_context(), fname);
+}
+
+int sfs_getinode(int i_node, char *fname){
+    return sfs_ctx_getinode(sfs_default_context(), i_node, fname);
+}
+
+int sfs_fopeninode(int i_node){
+    return sfs_ctx_fopeninode(sfs_default_context(), i_node);
+}
+
+int sfs_fopen(char *fname){
+    return sfs_ctx_fopen(sfs_default_context(), fname);
+}
+
+int sfs_fclose(int fileID){
+    return sfs_ctx_fclose(sfs_default_context(), fileID);
+}
+
+int sfs_fwrite(int fileID, const char *buf, int length){
+    return sfs_ctx_fwrite(sfs_default_context(), fileID, buf, length);
+}
+
+int sfs_fread(int fileID, char *buf, int length){
+    return sfs_ctx_fread(sfs_default_context(), fileID, buf, length);
+}
+
+int sfs_pread(int fileID, char *buf, int length, int offset){
+    return sfs_ctx_pread(sfs_default_context(), fileID, buf, length, offset);
+}
+
+int sfs_pwrite(int fileID, const char *buf, int length, int offset){
+    return sfs_ctx_pwrite(sfs_default_context(), fileID, buf, length, offset);
+}
+
+int sfs_fwritev(int fileID, const struct iovec *iov, int iovcnt){
+    return sfs_ctx_fwritev(sfs_default_context(), fileID, iov, iovcnt);
+}
+
+int sfs_freadv(int fileID, const struct iovec *iov, int iovcnt){
+    return sfs_ctx_freadv(sfs_default_context(), fileID, iov, iovcnt);
+}
+
+int sfs_pwritev(int fileID, const struct iovec *iov, int iovcnt, int offset){
+    return sfs_ctx_pwritev(sfs_default_context(), fileID, iov, iovcnt, offset);
+}
+
+int sfs_preadv(int fileID, const struct iovec *iov, int iovcnt, int offset){
+    return sfs_ctx_preadv(sfs_default_context(), fileID, iov, iovcnt, offset);
+}
+
+int sfs_fseek(int fileID, int location){
+    return sfs_ctx_fseek(sfs_default_context(), fileID, location);
+}
+
+int sfs_ftruncate(int fileID, int size){
+    return sfs_ctx_ftruncate(sfs_default_context(), fileID, size);
+}
+
+int sfs_fmap(int fileID, int offset, int length, int writing, file_extent *extents, int max_extents){
+    return sfs_ctx_fmap(sfs_default_context(), fileID, offset, length, writing, extents, max_extents);
+}
+
+int sfs_fmap_done(int fileID, int offset, int written){
+    return sfs_ctx_fmap_done(sfs_default_context(), fileID, offset, written);
+}
+
+void sfs_fmap_release(void){
+    sfs_ctx_fmap_release(sfs_default_context());
+}
+
+int sfs_remove(char *file){
+    return sfs_ctx_remove(sfs_default_context(), file);
 }
@@ -1,49 +1,116 @@
 #ifndef SFS_API_H
 #define SFS_API_H
 
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "disk_emu.h"
+#include "block_cache.h"
+
 /* mathematical functions */
 #define MIN(a, b)                          ( ( (a) < (b) ) ? (a) : (b) )    // gives the minimum value between a and b
 #define MAX(a, b)                          ( ( (a) > (b) ) ? (a) : (b) )    // gives the maximum value between a and b
 #define CEILING(a, b)                      ( ( (a) + (b) - 1 ) / (b) )      // gives the ceiling of a/b
 
 /* constants */
-#define MAGIC                              "0xACBD0005"                     // magic number
-#define BLOCK_SIZE                         1024                             // size of a data block
+#define MAGIC                              "0xACBD0008"                     // magic number (metadata journal)
+#define JOURNAL_MAGIC                      "SFSJRNL"                        // marks a transaction written to the journal
 
-#define NUM_OF_DIR_PTR                     12                               // number of direct pointers per i-Node
+#define NUM_OF_INLINE_EXTENTS              6                                // number of extents held by the i-Node itself
 #define PTR_SIZE                           sizeof(int)                      // size of a pointer ( it's an integer )
+#define BITS_PER_WORD                      64                               // number of blocks tracked by one word of the free bitmap
+#define MIN_RESERVATION                    8                                // number of blocks a file reserves ahead of its writes at first
+#define MAX_RESERVATION                    1024                             // maximum number of blocks a file reserves at once (the window doubles as the file grows)
+#define COMMIT_INTERVAL                    5000                             // time between two commits of the metadata journal (in ms)
+#define DESCRIPTORS_PER_FILE               4                                // number of file descriptors per possible file (a file can be opened several times)
 
-#define INACTIVE                           0                                // file is open
-#define ACTIVE                             1                                // file is closed
+#define INACTIVE                           0                                // i-Node of a file (or a free one)
 #define ROOT                               2                                // root directory
 
 #define MAX_FILENAME                       16                               // maximum length for a file name
 #define MAX_FILE_EXTENSION                 3                                // maximum length for a file extension
-#define MAX_FILES                          500                              // maximum number of files the system can hold ( arbitrary )
-#define MAX_FILE_SIZE                      ( ( BLOCK_SIZE * NUM_OF_DIR_PTR ) + ( BLOCK_SIZE * ( BLOCK_SIZE / PTR_SIZE ) ) ) // maximum size a file can have
 
-#define NUM_OF_BLOCKS                      CEILING(  MAX_FILES * MAX_FILE_SIZE , BLOCK_SIZE )   // maximum number of data blocks the file system can hold
+/* geometry (chosen when formatting, and recorded in the super block) */
+#define DEFAULT_BLOCK_SIZE                 1024                             // size of a data block, unless given to sfs_format
+#define DEFAULT_MAX_FILES                  500                              // maximum number of files, unless given to sfs_format
+#define DEFAULT_NUM_OF_BLOCKS              134000                           // number of blocks of the volume, unless given to sfs_format
+#define MIN_BLOCK_SIZE                     512                              // smallest block size (a power of two, the super block fits in a block)
+#define MAX_BLOCK_SIZE                     65536                            // largest block size (a power of two)
+
+#define DEFAULT_IMAGE                      "file_system.sfs"                // disk file of the volume the API without a context works on
+
+/* geometry of the volume fs (the functions working on a volume name it fs) */
+#define BLOCK_SIZE                         ( fs->super_block.block_size )                      // size of a data block
+#define MAX_FILES                          ( fs->super_block.i_node_table_length )             // maximum number of files the system can hold
+#define NUM_OF_BLOCKS                      ( fs->super_block.file_system_size )                // number of blocks the file system can hold
+#define EXTENTS_PER_LEAF                   ( (int)( BLOCK_SIZE / sizeof( extent ) ) )          // number of extents held by a leaf block
+#define LEAVES_PER_INDEX                   ( (int)( BLOCK_SIZE / PTR_SIZE ) )                  // number of leaf blocks listed by an index block
+#define MAX_EXTENTS_PER_FILE               ( EXTENTS_PER_LEAF * LEAVES_PER_INDEX )             // maximum number of extents a file can have
+#define MAX_DESCRIPTORS                    ( DESCRIPTORS_PER_FILE * MAX_FILES )                // number of entries of the file descriptor table
+
+#define MAX_FILE_SIZE                      ( (int)MIN( (long)BLOCK_SIZE * ( NUM_OF_BLOCKS - DATA_BLOCKS_ADDRESS ), INT_MAX - MAX_BLOCK_SIZE ) ) // maximum size a file can have (the whole data area, as long as its blocks can be counted in an int)
+#define BITMAP_WORDS                       CEILING(  NUM_OF_BLOCKS , BITS_PER_WORD )            // number of words needed to hold one bit per block
 
-#define ROOT_DIRECTORY_BLOCKS              CEILING(  sizeof( directory_table_struct ) , BLOCK_SIZE) // number of blocks needed to hold the directory table
-#define I_NODE_TABLE_BLOCKS                CEILING(  sizeof ( i_node_table_struct ) , BLOCK_SIZE )  // number of blocks needed to hold the i-Node table
-#define FREE_BITMAP_BLOCKS                 CEILING(  sizeof( bit_map_struct ) , BLOCK_SIZE )  // number of blocks needed to hold the free blocks bitmap
+#define ROOT_DIRECTORY_BLOCKS              ( (int)CEILING(  MAX_FILES * sizeof( directory_entry ) , BLOCK_SIZE ) ) // number of blocks needed to hold the directory table
+#define I_NODE_TABLE_BLOCKS                ( (int)CEILING(  MAX_FILES * sizeof( i_node ) , BLOCK_SIZE ) )          // number of blocks needed to hold the i-Node table
+#define FREE_BITMAP_BLOCKS                 ( (int)CEILING(  BITMAP_WORDS * sizeof( uint64_t ) , BLOCK_SIZE ) )     // number of blocks needed to hold the free blocks bitmap
 
 #define SUPER_BLOCK_ADDRESS                0                                                    // address of the super block
 #define I_NODE_TABLE_ADDRESS               1                                                    // address of the i-Node table
 #define FREE_BITMAP_ADDRESS                ( I_NODE_TABLE_ADDRESS + I_NODE_TABLE_BLOCKS )       // address of the free bitmap
 #define ROOT_DIRECTORY_ADDRESS             ( FREE_BITMAP_ADDRESS + FREE_BITMAP_BLOCKS )         // address of the directory table
-#define DATA_BLOCKS_ADDRESS                ( ROOT_DIRECTORY_ADDRESS + ROOT_DIRECTORY_BLOCKS )   // minimum address of the data blocks (to hold the files' content)
+#define JOURNAL_ADDRESS                    ( ROOT_DIRECTORY_ADDRESS + ROOT_DIRECTORY_BLOCKS )   // address of the metadata journal
+#define DATA_BLOCKS_ADDRESS                ( JOURNAL_ADDRESS + JOURNAL_BLOCKS )                 // minimum address of the data blocks (to hold the files' content)
+
+#define JOURNAL_LEAF_BLOCKS                ( MIN( LEAVES_PER_INDEX, (int)CEILING( NUM_OF_BLOCKS, EXTENTS_PER_LEAF ) ) + 1 )      // number of leaf and index blocks one operation can write
+#define JOURNAL_LEAF_ROOM                  ( 2 * JOURNAL_LEAF_BLOCKS )                                                            // number of leaf and index blocks a transaction can hold
+#define JOURNAL_CAPACITY                   ( I_NODE_TABLE_BLOCKS + FREE_BITMAP_BLOCKS + ROOT_DIRECTORY_BLOCKS + JOURNAL_LEAF_ROOM )  // number of blocks a transaction can write
+#define JOURNAL_DESCRIPTOR_BLOCKS          ( (int)CEILING( sizeof( journal_header ) + JOURNAL_CAPACITY * PTR_SIZE, BLOCK_SIZE ) )    // number of blocks holding the header and the addresses of a transaction
+#define JOURNAL_BLOCKS                     ( JOURNAL_DESCRIPTOR_BLOCKS + JOURNAL_CAPACITY )                                          // number of blocks of the journal
 
 
 /* data structures */
+// extent (run of consecutive blocks of a file)
+typedef struct {
+    int start; // address of the first block of the run
+    int length; // number of blocks in the run
+} extent;
+
+// extents of an open file, loaded when the file is opened
+typedef struct {
+    extent *extents; // extents of the file, in file order
+    int *first_blocks; // index (in the file) of the first block of each extent
+    int capacity; // number of extents the arrays can hold
+    int *leaves; // addresses of the leaf blocks holding the extents on the disk, NULL while they fit in the i-Node
+    int first_dirty; // first extent that changed since the map was written to the disk
+    int leaves_dirty; // 1 = the index block listing the leaves must be written back
+} extent_map;
+
+// open file table (what the descriptors of a file share)
+typedef struct {
+    int ref_count; // number of descriptors open on the file, 0 if it is closed
+    extent_map map; // where the blocks of the file are on the disk
+    int reserved_start; // first block reserved for the file to grow into
+    int reserved_length; // number of blocks left in the reservation
+    int window; // size of the last reservation (the next one is twice as large)
+    int journal_room; // room the operation writing the file set aside in the transaction (in leaf and index blocks)
+    int mapped; // 1 while a write mapped by sfs_fmap waits for sfs_fmap_done (the file stays locked until then)
+    int map_descriptor, map_offset, map_length, map_size; // descriptor and range of that write, and the size of the file before it
+} open_file_entry;
+
 // file descriptor table
 typedef struct {
     int i_node_number; // -1 if this entry corresponds to no open file
-    int read_write_ptr; // position of the pointer in the file
+    int read_write_ptr; // position of the pointer in the file (each descriptor has its own)
+    int next_free; // next free entry, while this one is free (-1 at the end of the list)
 } file_descriptor_entry;
 typedef struct {
-    file_descriptor_entry file_descriptors[ MAX_FILES ]; // file descriptor table
-    int num_of_files; // current number of opened files
+    file_descriptor_entry *file_descriptors; // file descriptor table (MAX_DESCRIPTORS entries)
+    open_file_entry *open_files; // open file table (the index corresponds to the i-Node number)
+    int first_free; // first free entry of the file descriptor table, -1 if it is full
+    int num_of_files; // current number of open file descriptors
 } FDT_struct;
 
 // directory table
@@ -52,55 +119,267 @@ typedef struct {
     char filename[ MAX_FILENAME + MAX_FILE_EXTENSION + 2 ]; // +1 dot +1 null terminated
 } directory_entry;
 typedef struct {
-    directory_entry directories[ MAX_FILES ]; // directory table (the index corresponds to the i-Node number)
-    int num_of_dir; // current number of directories
+    directory_entry *directories; // directory table (the index corresponds to the i-Node number), the part written to the disk
+    int num_of_dir; // current number of directories (counted when mounting)
 } directory_table_struct;
 
+// hash index over the directory table (file name -> index in the directory table)
+typedef struct {
+    int *heads; // first directory index of each bucket, -1 if the bucket is empty
+    int *next; // next directory index in the same bucket, -1 at the end of the chain
+    int num_of_buckets; // number of buckets ( power of two, at least MAX_FILES )
+} directory_index_struct;
+
 // super block
 typedef struct {
     char magic[16]; // to recognize whether the disk file is compatible
     int block_size; // size of the data blocks
-    int file_system_size; // file system size and i-node table length
-    int i_node_table_length; // maximum number of i-Nodes
+    int file_system_size; // number of blocks of the file system
+    int i_node_table_length; // maximum number of i-Nodes (and of files)
     int root; // address of the root directory
 } super_block_struct;
 
 // i-Node
 typedef struct {
-    int mode; //  ACTIVE or INACTIVE
+    int mode; //  INACTIVE, or ROOT for the root (whether a file is open is kept in the open file table)
     int size; // size of the file associated with this i-Node
-    int link_count; // number of (indirect and direct) pointers
-    int direct_ptr[ NUM_OF_DIR_PTR ]; // blocks (number) this i-Node needs
-    int indirect_ptr; // other dirs after this one
+    int link_count; // number of data blocks of the file
+    int num_of_extents; // number of extents mapping the data blocks
+    extent extents[ NUM_OF_INLINE_EXTENTS ]; // the extents, while there are at most NUM_OF_INLINE_EXTENTS of them
+    int extent_index; // otherwise, address of the index block listing the leaf blocks that hold them (-1 if none)
 } i_node;
 typedef struct {
-    i_node i_nodes[ MAX_FILES ]; // i-Node table
+    i_node *i_nodes; // i-Node table, the part written to the disk
     int num_of_i_nodes; // number of allocated i-Nodes (prevents from parsing the whole table)
 } i_node_table_struct;
 
 // bitmap to keep track of free/allocated space
 typedef struct {
-    int is_free[ NUM_OF_BLOCKS ]; // 1 = free, 0 = allocated
-    int size; // number of allocated blocks
+    uint64_t *is_free; // one bit per block, 1 = free, 0 = allocated (bits past the last block stay 0), the part written to the disk
+    int size; // number of allocated blocks (counted when mounting)
 } bit_map_struct;
 
+// entry of a directory listing (filled by sfs_readdir)
+typedef struct {
+    char filename[ MAX_FILENAME + MAX_FILE_EXTENSION + 2 ]; // name of the file
+    int i_node_number; // i-Node number of the file (the next listing starts after it)
+    int size; // size of the file
+} readdir_entry;
+
+// range of an open file that lies in consecutive bytes of the disk file
+typedef struct {
+    long disk_offset; // position of the range in the disk file (in bytes)
+    int length; // length of the range (in bytes)
+} file_extent;
+
+// metadata region (an on-disk table kept in memory, written back one block at a time)
+typedef struct {
+    void *table; // in-memory copy of the table
+    int size; // size of the in-memory copy (in bytes)
+    int address; // address of the first block of the table on the disk
+    int num_of_blocks; // number of blocks the table spans on the disk
+    char *dirty; // one flag per block, 1 = must be written back, 0 = the disk is up to date
+} metadata_region;
+
+// header of the transaction held by the journal (followed by the addresses of its blocks, then by the blocks themselves)
+typedef struct {
+    char magic[8]; // JOURNAL_MAGIC if the journal holds a transaction
+    int sequence; // number of the transaction
+    int num_of_blocks; // number of blocks it writes
+    uint64_t checksum; // checksum of the addresses and blocks, a transaction cut short by a crash does not match it
+} journal_header;
+
+// metadata journal (the transaction being built, written to the journal in one go when it commits)
+typedef struct {
+    char *buffer; // header, addresses, then blocks of the transaction, as they are written to the journal
+    int num_of_blocks; // number of leaf and index blocks written to the transaction so far (the metadata tables are added when it commits)
+    int reserved; // room set aside for the leaf and index blocks of the operations in progress
+    int sequence; // number of the last transaction committed
+    long last_commit; // time of the last commit (in ms)
+    uint64_t *pending_frees; // blocks freed by the transaction (1 = pending), they can not be reused before it commits
+    int num_of_pending_frees; // number of blocks freed by the transaction
+} journal_struct;
+
+// volume (a disk file, and everything the file system keeps in memory about it)
+typedef struct {
+    char *image; // path of the disk file
+    disk_struct disk; // the disk file, once opened
+    block_cache *cache; // cache over the data blocks of the disk
+    int cache_budget, cache_mode; // memory budget and write policy of the cache
+
+    // data structures (on-disk and in-memory, sized by the geometry when mounting)
+    i_node_table_struct i_node_table; // i-Node table
+    directory_table_struct directory_table; // directory table
+
+    // data structures (on-disk only)
+    super_block_struct super_block; // super block (holds the geometry of the mounted file system)
+    bit_map_struct bit_map; // free block bitmap (1 = free, 0 = allocated)
+
+    // data structures (in-memory only, sized by the geometry when mounting)
+    FDT_struct FDT; // file descriptor table
+    directory_index_struct directory_index; // hash index over the directory table
+    uint64_t *reserved_blocks; // blocks held for the open files to grow into (1 = reserved), free in the bitmap all the same
+    int read_maps; // reads mapped by sfs_fmap whose callers have not copied the data out yet (the pending frees wait for them)
+    journal_struct journal; // transaction of metadata changes, not yet committed to the journal
+    int alloc_cursor; // block where the search for a free block resumes (next-fit)
+
+    // metadata regions (which blocks of the on-disk tables are out of date), laid out when mounting
+    metadata_region i_node_region, bit_map_region, directory_region;
+
+    // locks (always taken in this order), the API functions take them and the helpers expect them to be held
+    // the operations that change metadata share the transaction lock, a commit holds it alone
+    // the size and extents of a file, its open file entry (reference count, extent map, reservation) and the pointers of its descriptors go with the lock of its i-Node
+    // (the readers of a file share that lock, they move the pointers under the FDT lock)
+    // the bitmap, the reservations, the cursor, the pending frees and the mapped reads go with the allocator lock
+    pthread_rwlock_t transaction_lock; // shared by the operations that change metadata, held alone by a commit
+    pthread_rwlock_t directory_lock; // directory table and index, number of files and i-Nodes
+    pthread_rwlock_t *i_node_locks; // one per i-Node, sized by the geometry when mounting
+    pthread_mutex_t FDT_lock; // slots of the file descriptor table and its free list
+    pthread_mutex_t allocator_lock; // free bitmap, reservations, allocation cursor and pending frees
+    pthread_mutex_t journal_lock; // leaf and index blocks of the transaction, dirty flags of the metadata regions
+    pthread_cond_t journal_room; // signaled when an operation gives back the room it set aside in the transaction
+
+    // committer thread (commits the transaction every commit interval while the volume is mounted)
+    pthread_t committer;
+    int committer_running; // the thread was started and not joined yet
+    int committer_stop; // asks the thread to end
+    pthread_mutex_t committer_lock; // flag to stop the thread (taken by the thread and by the unmount only, before the journal lock)
+    pthread_cond_t committer_wake; // signaled to stop the thread before the commit interval is over
+} sfs_context;
+
 /* helper functions */
-int next_free_block(void);
-int next_free_dir_entry(void);
-int get_dir_index(const char*);
-int create_FDT_entry(int);
-void write_i_node(int);
-void read_i_nodes(void);
-
-/* API functions */
+int is_block_free(sfs_context*, int);
+void set_block_free(sfs_context*, int);
+void set_block_allocated(sfs_context*, int);
+uint64_t available_blocks(sfs_context*, int);
+int is_block_available(sfs_context*, int);
+int next_free_block(sfs_context*);
+int free_run_length(sfs_context*, int, int);
+int find_free_run(sfs_context*, int, int, int*);
+void set_blocks_reserved(sfs_context*, int, int, int);
+int reserve_blocks(sfs_context*, open_file_entry*, i_node*, int);
+void drop_reservation(sfs_context*, open_file_entry*);
+void release_blocks(sfs_context*, int, int);
+int next_free_dir_entry(sfs_context*);
+unsigned int hash_filename(sfs_context*, const char*);
+void dir_index_insert(sfs_context*, int);
+void dir_index_remove(sfs_context*, int);
+void build_dir_index(sfs_context*);
+int get_dir_index(sfs_context*, const char*);
+int load_extent_map(sfs_context*, extent_map*, int);
+void free_extent_map(extent_map*);
+int map_block(const extent_map*, const i_node*, int, int*);
+int add_extent_room(sfs_context*, extent_map*, i_node*);
+void store_extent_map(sfs_context*, extent_map*, i_node*);
+void truncate_extent_map(sfs_context*, extent_map*, i_node*, int);
+int create_FDT_entry(sfs_context*, int);
+int lock_file(sfs_context*, int, int);
+int lock_file_growing(sfs_context*, int, int, int);
+void unlock_file(sfs_context*, int, int);
+int open_i_node(sfs_context*, int);
+int create_file(sfs_context*, char*);
+int append_block(sfs_context*, int, int);
+int vector_length(const struct iovec*, int);
+const char *gather_bytes(const struct iovec*, int*, size_t*, int, char*);
+void scatter_bytes(const struct iovec*, int*, size_t*, const char*, int);
+int write_file(sfs_context*, int, const char*, int, int);
+int write_file_v(sfs_context*, int, const struct iovec*, int, int);
+int open_file_size(sfs_context*, int);
+int room_to_grow(sfs_context*, i_node*, long);
+void shrink_file(sfs_context*, int, int);
+int grow_file(sfs_context*, int, int);
+int read_file(sfs_context*, int, char*, int, int);
+int read_file_v(sfs_context*, int, const struct iovec*, int, int);
+void mark_dirty(sfs_context*, metadata_region*, const void*, int);
+void load_region(sfs_context*, metadata_region*);
+void flush_region(sfs_context*, metadata_region*);
+void flush_metadata(sfs_context*);
+void mark_i_node_dirty(sfs_context*, int);
+void mark_dir_entry_dirty(sfs_context*, int);
+void read_i_nodes(sfs_context*);
+int check_geometry(sfs_context*);
+int alloc_tables(sfs_context*);
+void free_tables(sfs_context*);
+long current_time(void);
+uint64_t journal_checksum(const char*, long);
+void journal_write_block(sfs_context*, int, const void*);
+void journal_read_block(sfs_context*, int, void*);
+void release_pending_frees(sfs_context*);
+int commit_transaction(sfs_context*);
+int journal_commit(sfs_context*);
+int commit_due(sfs_context*);
+void commit_if_due(sfs_context*);
+void *committer(void*);
+void start_committer(sfs_context*);
+void stop_committer(sfs_context*);
+void reclaim_pending_frees(sfs_context*, int);
+int journal_room_needed(sfs_context*, int, long);
+void wait_journal_room(sfs_context*, int);
+void journal_replay(sfs_context*);
+void unmount_volume(sfs_context*);
+int format_volume(sfs_context*, int, int, int);
+int mount_volume(sfs_context*);
+int init_context(sfs_context*, const char*);
+void destroy_context(sfs_context*);
+void init_default_volume(void);
+
+/* API functions on a volume */
+sfs_context *sfs_mount(const char*);
+sfs_context *sfs_mkfs(const char*, int, int, int);
+void sfs_unmount(sfs_context*);
+void sfs_ctx_cache_config(sfs_context*, int, int);
+int sfs_ctx_flush(sfs_context*);
+int sfs_ctx_sync(sfs_context*);
+int sfs_ctx_readdir(sfs_context*, int, readdir_entry*, int);
+int sfs_ctx_getfilesize(sfs_context*, const char*);
+int sfs_ctx_lookup(sfs_context*, const char*);
+int sfs_ctx_getinode(sfs_context*, int, char*);
+int sfs_ctx_fopeninode(sfs_context*, int);
+int sfs_ctx_fopen(sfs_context*, char*);
+int sfs_ctx_fclose(sfs_context*, int);
+int sfs_ctx_fwrite(sfs_context*, int, const char*, int);
+int sfs_ctx_fread(sfs_context*, int, char*, int);
+int sfs_ctx_pwrite(sfs_context*, int, const char*, int, int);
+int sfs_ctx_pread(sfs_context*, int, char*, int, int);
+int sfs_ctx_fwritev(sfs_context*, int, const struct iovec*, int);
+int sfs_ctx_freadv(sfs_context*, int, const struct iovec*, int);
+int sfs_ctx_pwritev(sfs_context*, int, const struct iovec*, int, int);
+int sfs_ctx_preadv(sfs_context*, int, const struct iovec*, int, int);
+int sfs_ctx_fseek(sfs_context*, int, int);
+int sfs_ctx_ftruncate(sfs_context*, int, int);
+int sfs_ctx_fmap(sfs_context*, int, int, int, int, file_extent*, int);
+int sfs_ctx_fmap_done(sfs_context*, int, int, int);
+void sfs_ctx_fmap_release(sfs_context*);
+int sfs_ctx_remove(sfs_context*, char*);
+
+/* API functions on the default volume (DEFAULT_IMAGE) */
+sfs_context *sfs_default_context(void);
 void mksfs(int);
+int sfs_format(int, int, int);
+void sfs_cache_config(int, int);
+int sfs_flush(void);
+int sfs_sync(void);
+int sfs_readdir(int, readdir_entry*, int);
 int sfs_getnextfilename(char*);
 int sfs_getfilesize(const char*);
+int sfs_lookup(const char*);
+int sfs_getinode(int, char*);
+int sfs_fopeninode(int);
 int sfs_fopen(char*);
 int sfs_fclose(int);
 int sfs_fwrite(int, const char*, int);
 int sfs_fread(int, char*, int);
+int sfs_pwrite(int, const char*, int, int);
+int sfs_pread(int, char*, int, int);
+int sfs_fwritev(int, const struct iovec*, int);
+int sfs_freadv(int, const struct iovec*, int);
+int sfs_pwritev(int, const struct iovec*, int, int);
+int sfs_preadv(int, const struct iovec*, int, int);
 int sfs_fseek(int, int);
+int sfs_ftruncate(int, int);
+int sfs_fmap(int, int, int, int, file_extent*, int);
+int sfs_fmap_done(int, int, int);
+void sfs_fmap_release(void);
 int sfs_remove(char*);
 
 #endif
@@ -0,0 +1,213 @@
+// Spreads the files of the simple file system (SFS) across several volumes (shards).
+// A file lives on the shard its name hashes to, so operations on different files
+// mostly touch different tables, bitmaps and journals. Each shard has a worker thread
+// that carries out the requests queued to it, in order.
+
+/* includes */
+#include "sfs_shards.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* ( helper ) find the shard holding the given file (FNV-1a hash of its name) */
+unsigned int shard_of(const sfs_shard_set *set, const char *file){
+    unsigned int hash = 2166136261u;
+    for ( ; *file; file++ ) hash = ( hash ^ (unsigned char)*file ) * 16777619u;
+    return hash % set->num_of_shards;
+}
+
+/* ( helper ) carry out the requests queued to a shard, until it is stopped */
+void *shard_worker(void *arg){
+    shard *s = arg;
+    pthread_mutex_lock(&s->lock);
+    while ( 1 ) {
+        // wait for a request
+        while ( !s->first && !s->stopping ) pthread_cond_wait(&s->queued, &s->lock);
+        if ( !s->first ) break;
+        shard_request *request = s->first;
+        s->first = request->next;
+        if ( !s->first ) s->last = NULL;
+        // carry it out without holding the queue
+        pthread_mutex_unlock(&s->lock);
+        switch ( request->operation ) {
+            case SHARD_FOPEN: request->result = sfs_ctx_fopen(s->volume, request->name); break;
+            case SHARD_FCLOSE: request->result = sfs_ctx_fclose(s->volume, request->fd); break;
+            case SHARD_FWRITE: request->result = sfs_ctx_fwrite(s->volume, request->fd, request->buffer, request->length); break;
+            case SHARD_FREAD: request->result = sfs_ctx_fread(s->volume, request->fd, request->buffer, request->length); break;
+            case SHARD_FSEEK: request->result = sfs_ctx_fseek(s->volume, request->fd, request->length); break;
+            case SHARD_FTRUNCATE: request->result = sfs_ctx_ftruncate(s->volume, request->fd, request->length); break;
+            case SHARD_REMOVE: request->result = sfs_ctx_remove(s->volume, request->name); break;
+            case SHARD_GETFILESIZE: request->result = sfs_ctx_getfilesize(s->volume, request->name); break;
+            case SHARD_READDIR: request->result = sfs_ctx_readdir(s->volume, request->fd, request->entries, request->length); break;
+            case SHARD_SYNC: request->result = sfs_ctx_sync(s->volume); break;
+        }
+        // and wake up the caller
+        pthread_mutex_lock(&s->lock);
+        request->done = 1;
+        pthread_cond_broadcast(&s->done);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* ( helper ) queue a request to a shard and wait until it is carried out, return its result */
+int shard_call(shard *s, shard_request *request){
+    request->done = 0;
+    request->next = NULL;
+    pthread_mutex_lock(&s->lock);
+    if ( s->last ) s->last->next = request;
+    else s->first = request;
+    s->last = request;
+    pthread_cond_signal(&s->queued);
+    while ( !request->done ) pthread_cond_wait(&s->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return request->result;
+}
+
+/* open a set of num_of_shards shards (SHARD_IMAGE, numbered from 0), fresh ones with the default geometry
+ * or the existing ones, return NULL on failure */
+sfs_shard_set *sfs_shards_open(int num_of_shards, int fresh){
+    if ( num_of_shards < 1 || num_of_shards > MAX_SHARDS ) {
+        fprintf(stderr,"Error, invalid number of shards %d.\n", num_of_shards);
+        return NULL;
+    }
+    sfs_shard_set *set = calloc(1, sizeof(sfs_shard_set));
+    if ( !set || !( set->shards = calloc(num_of_shards, sizeof(shard)) ) ) {
+        fprintf(stderr,"Error, could not allocate a set of %d shards.\n", num_of_shards);
+        free(set);
+        return NULL;
+    }
+    pthread_mutex_init(&set->listing_lock, NULL);
+    set->listing_cookie = 1;
+    // mount every shard, and start its worker
+    char image[32];
+    for ( int i=0; i < num_of_shards; i++ ) {
+        shard *s = &set->shards[i];
+        sprintf(image, SHARD_IMAGE, i);
+        s->volume = fresh ? sfs_mkfs(image, DEFAULT_BLOCK_SIZE, DEFAULT_MAX_FILES, DEFAULT_NUM_OF_BLOCKS) : sfs_mount(image);
+        if ( !s->volume ) {
+            sfs_shards_close(set);
+            return NULL;
+        }
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->queued, NULL);
+        pthread_cond_init(&s->done, NULL);
+        // (the set only counts the shards that are running, so closing it stops them)
+        if ( pthread_create(&s->worker, NULL, shard_worker, s) ) {
+            fprintf(stderr,"Error, could not start the worker of shard %d.\n", i);
+            sfs_unmount(s->volume);
+            sfs_shards_close(set);
+            return NULL;
+        }
+        set->num_of_shards++;
+    }
+    return set;
+}
+
+/* stop the workers once their queues are empty, then unmount every shard and release the set */
+void sfs_shards_close(sfs_shard_set *set){
+    for ( int i=0; i < set->num_of_shards; i++ ) {
+        shard *s = &set->shards[i];
+        pthread_mutex_lock(&s->lock);
+        s->stopping = 1;
+        pthread_cond_signal(&s->queued);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->worker, NULL);
+        sfs_unmount(s->volume);
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->queued);
+        pthread_cond_destroy(&s->done);
+    }
+    pthread_mutex_destroy(&set->listing_lock);
+    free(set->shards);
+    free(set);
+}
+
+/* commit every shard, return -1 if one of them fails */
+int sfs_shards_sync(sfs_shard_set *set){
+    int res = 0;
+    for ( int i=0; i < set->num_of_shards; i++ ) {
+        shard_request request = { .operation = SHARD_SYNC };
+        if ( shard_call(&set->shards[i], &request) == -1 ) res = -1;
+    }
+    return res;
+}
+
+/* open the specified file on its shard (creating it if needed), return the descriptor of the set */
+int sfs_shards_fopen(sfs_shard_set *set, char *fname){
+    int index = shard_of(set, fname);
+    shard_request request = { .operation = SHARD_FOPEN, .name = fname };
+    int fd = shard_call(&set->shards[index], &request);
+    return fd == -1 ? -1 : fd * set->num_of_shards + index;
+}
+
+/* close the specified file */
+int sfs_shards_fclose(sfs_shard_set *set, int fileID){
+    if ( fileID < 0 ) return -1;
+    shard_request request = { .operation = SHARD_FCLOSE, .fd = fileID / set->num_of_shards };
+    return shard_call(&set->shards[fileID % set->num_of_shards], &request);
+}
+
+/* write buffer characters onto an open file, return the number of bytes written */
+int sfs_shards_fwrite(sfs_shard_set *set, int fileID, const char *buf, int length){
+    if ( fileID < 0 ) return 0;
+    shard_request request = { .operation = SHARD_FWRITE, .fd = fileID / set->num_of_shards, .buffer = (char *)buf, .length = length };
+    return shard_call(&set->shards[fileID % set->num_of_shards], &request);
+}
+
+/* read characters from an open file into the buffer, return the number of bytes read */
+int sfs_shards_fread(sfs_shard_set *set, int fileID, char *buf, int length){
+    if ( fileID < 0 ) return 0;
+    shard_request request = { .operation = SHARD_FREAD, .fd = fileID / set->num_of_shards, .buffer = buf, .length = length };
+    return shard_call(&set->shards[fileID % set->num_of_shards], &request);
+}
+
+/* move the read/write pointer of an open file to the specified location */
+int sfs_shards_fseek(sfs_shard_set *set, int fileID, int location){
+    if ( fileID < 0 ) return -1;
+    shard_request request = { .operation = SHARD_FSEEK, .fd = fileID / set->num_of_shards, .length = location };
+    return shard_call(&set->shards[fileID % set->num_of_shards], &request);
+}
+
+/* change the size of an open file */
+int sfs_shards_ftruncate(sfs_shard_set *set, int fileID, int size){
+    if ( fileID < 0 ) return -1;
+    shard_request request = { .operation = SHARD_FTRUNCATE, .fd = fileID / set->num_of_shards, .length = size };
+    return shard_call(&set->shards[fileID % set->num_of_shards], &request);
+}
+
+/* remove a file from its shard */
+int sfs_shards_remove(sfs_shard_set *set, char *file){
+    shard_request request = { .operation = SHARD_REMOVE, .name = file };
+    return shard_call(&set->shards[shard_of(set, file)], &request);
+}
+
+/* get the size of the specified file (-1 if it does not exist) */
+int sfs_shards_getfilesize(sfs_shard_set *set, char *path){
+    shard_request request = { .operation = SHARD_GETFILESIZE, .name = path };
+    return shard_call(&set->shards[shard_of(set, path)], &request);
+}
+
+/* get the name of the next file of the set (the files of shard 0 first, then shard 1, ...)
+ * return 0 once every file is listed, and start over on the next call */
+int sfs_shards_getnextfilename(sfs_shard_set *set, char *fname){
+    readdir_entry entry;
+    pthread_mutex_lock(&set->listing_lock);
+    while ( set->listing_shard < set->num_of_shards ) {
+        shard_request request = { .operation = SHARD_READDIR, .fd = set->listing_cookie, .entries = &entry, .length = 1 };
+        // the next file of this shard, the listing goes on after it
+        if ( shard_call(&set->shards[set->listing_shard], &request) ) {
+            strcpy(fname, entry.filename);
+            set->listing_cookie = entry.i_node_number + 1;
+            pthread_mutex_unlock(&set->listing_lock);
+            return 1;
+        }
+        // every file of this shard is listed, move on to the next one
+        set->listing_shard++;
+        set->listing_cookie = 1;
+    }
+    set->listing_shard = 0;
+    pthread_mutex_unlock(&set->listing_lock);
+    return 0;
+}
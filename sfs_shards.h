@@ -0,0 +1,68 @@
+#ifndef SFS_SHARDS_H
+#define SFS_SHARDS_H
+
+#include <pthread.h>
+
+#include "sfs_api.h"
+
+/* constants */
+#define SHARD_IMAGE                        "file_system.%d.sfs"             // disk file of each shard (numbered from 0)
+#define MAX_SHARDS                         64                               // maximum number of shards of a set
+
+/* operations a shard worker carries out */
+enum shard_operation { SHARD_FOPEN, SHARD_FCLOSE, SHARD_FWRITE, SHARD_FREAD, SHARD_FSEEK, SHARD_FTRUNCATE,
+                       SHARD_REMOVE, SHARD_GETFILESIZE, SHARD_READDIR, SHARD_SYNC };
+
+/* data structures */
+// request queued to a shard (lives on the stack of the caller, who waits for it)
+typedef struct shard_request {
+    enum shard_operation operation; // what to do
+    int fd; // descriptor on the volume of the shard
+    char *name; // file name (open, remove, size)
+    char *buffer; // data to write or read into
+    int length; // length of the data, new size, location or number of entries
+    readdir_entry *entries; // entries to fill (listing)
+    int result; // what the operation returned
+    int done; // 1 once the worker carried it out
+    struct shard_request *next; // next request in the queue
+} shard_request;
+
+// shard (a volume, and the thread that works on it)
+typedef struct {
+    sfs_context *volume; // the volume
+    pthread_t worker; // thread carrying out the requests
+    pthread_mutex_t lock; // queue and done flags
+    pthread_cond_t queued; // signalled when a request is queued
+    pthread_cond_t done; // broadcast when a request is carried out
+    shard_request *first, *last; // queue of requests, oldest first
+    int stopping; // 1 = the worker exits once the queue is empty
+} shard;
+
+// set of shards, files are spread across them by hashing their names
+typedef struct {
+    shard *shards; // the shards
+    int num_of_shards; // number of shards
+    pthread_mutex_t listing_lock; // listing cursor
+    int listing_shard, listing_cookie; // where the listing of sfs_shards_getnextfilename resumes
+} sfs_shard_set;
+
+/* helper functions */
+unsigned int shard_of(const sfs_shard_set*, const char*);
+void *shard_worker(void*);
+int shard_call(shard*, shard_request*);
+
+/* API functions (a descriptor of the set is the descriptor on the shard * number of shards + the shard) */
+sfs_shard_set *sfs_shards_open(int, int);
+void sfs_shards_close(sfs_shard_set*);
+int sfs_shards_sync(sfs_shard_set*);
+int sfs_shards_fopen(sfs_shard_set*, char*);
+int sfs_shards_fclose(sfs_shard_set*, int);
+int sfs_shards_fwrite(sfs_shard_set*, int, const char*, int);
+int sfs_shards_fread(sfs_shard_set*, int, char*, int);
+int sfs_shards_fseek(sfs_shard_set*, int, int);
+int sfs_shards_ftruncate(sfs_shard_set*, int, int);
+int sfs_shards_remove(sfs_shard_set*, char*);
+int sfs_shards_getfilesize(sfs_shard_set*, char*);
+int sfs_shards_getnextfilename(sfs_shard_set*, char*);
+
+#endif
@@ -91,10 +91,14 @@ main(int argc, char **argv)
       fprintf(stderr, "ERROR: creating first test file %s\n", names[i]);
       error_count++;
     }
+    /* a second open gets a descriptor of its own */
     tmp = sfs_fopen(names[i]);
-
-    if (tmp >= 0 && tmp != fds[i]) {
-      fprintf(stderr, "ERROR: file %s was opened twice\n", names[i]);
+    if (tmp < 0 || tmp == fds[i]) {
+      fprintf(stderr, "ERROR: file %s could not be opened twice\n", names[i]);
+      error_count++;
+    }
+    else if (sfs_fclose(tmp) != 0) {
+      fprintf(stderr, "ERROR: close of second handle %d failed\n", tmp);
       error_count++;
     }
     filesize[i] = (rand() % (MAX_BYTES-MIN_BYTES)) + MIN_BYTES;
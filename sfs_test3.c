@@ -0,0 +1,732 @@
+/* sfs_test3.c
+ *
+ * Tests the parts of the API that go beyond the assignment (volume geometry, ...).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sfs_api.h"
+#include "sfs_shards.h"
+
+/* number of threads sharing the file system */
+#define NUM_OF_THREADS 8
+
+/* Writes a file filled with a pattern that depends on its name, and
+ * returns the number of errors.
+ */
+int write_pattern(char *name, int size)
+{
+  char *buffer = malloc(size);
+  int fd, i;
+
+  for (i = 0; i < size; i++) {
+    buffer[i] = name[0] + i % 251;
+  }
+  fd = sfs_fopen(name);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR: creating %s failed\n", name);
+    free(buffer);
+    return 1;
+  }
+  if (sfs_fwrite(fd, buffer, size) != size) {
+    fprintf(stderr, "ERROR: writing %d bytes to %s failed\n", size, name);
+    sfs_fclose(fd);
+    free(buffer);
+    return 1;
+  }
+  sfs_fclose(fd);
+  free(buffer);
+  return 0;
+}
+
+/* Reads back a file written by write_pattern, and returns the number
+ * of errors.
+ */
+int check_pattern(char *name, int size)
+{
+  char *buffer = malloc(size);
+  int fd, i;
+
+  fd = sfs_fopen(name);
+  if (fd < 0 || sfs_getfilesize(name) != size) {
+    fprintf(stderr, "ERROR: %s is missing or has the wrong size\n", name);
+    free(buffer);
+    return 1;
+  }
+  sfs_fseek(fd, 0);
+  if (sfs_fread(fd, buffer, size) != size) {
+    fprintf(stderr, "ERROR: reading %d bytes from %s failed\n", size, name);
+    sfs_fclose(fd);
+    free(buffer);
+    return 1;
+  }
+  sfs_fclose(fd);
+  for (i = 0; i < size; i++) {
+    if (buffer[i] != (char)(name[0] + i % 251)) {
+      fprintf(stderr, "ERROR: wrong byte in %s at position %d\n", name, i);
+      free(buffer);
+      return 1;
+    }
+  }
+  free(buffer);
+  return 0;
+}
+
+/* Writes, reads back and removes files from several threads at once, and
+ * returns the number of errors (the thread number is passed as argument).
+ */
+void *thread_files(void *arg)
+{
+  long errors = 0;
+  char name[MAX_FILENAME];
+  int thread = (long)arg;
+  int i;
+
+  for (i = 0; i < 20; i++) {
+    sprintf(name, "%c%d.TMP", 'A' + thread, i);
+    errors += write_pattern(name, 1000 + 3000 * i);
+    errors += check_pattern(name, 1000 + 3000 * i);
+    /* every other file is removed, the others are checked after mounting again */
+    if (i % 2 && sfs_remove(name) != 0) {
+      fprintf(stderr, "ERROR: removing %s failed\n", name);
+      errors++;
+    }
+  }
+  return (void *)errors;
+}
+
+/* Streams a file through a descriptor of its own, while the other threads
+ * stream it through theirs, and returns the number of errors.
+ */
+void *thread_reader(void *arg)
+{
+  long errors = 0;
+  char buffer[1000];
+  int fd, i, j, k;
+
+  for (i = 0; i < 10; i++) {
+    fd = sfs_fopen("HOT.TXT");
+    if (fd < 0) {
+      fprintf(stderr, "ERROR: opening HOT.TXT from a reader failed\n");
+      return (void *)(errors + 1);
+    }
+    sfs_fseek(fd, 0);
+    for (j = 0; j < 50000; j += sizeof(buffer)) {
+      if (sfs_fread(fd, buffer, sizeof(buffer)) != sizeof(buffer)) {
+        fprintf(stderr, "ERROR: reading HOT.TXT at position %d failed\n", j);
+        errors++;
+        break;
+      }
+      for (k = 0; k < sizeof(buffer) && buffer[k] == (char)('H' + (j + k) % 251); k++);
+      if (k < sizeof(buffer)) {
+        fprintf(stderr, "ERROR: wrong byte in HOT.TXT at position %d\n", j + k);
+        errors++;
+        break;
+      }
+    }
+    sfs_fclose(fd);
+  }
+  return (void *)errors;
+}
+
+/* Fills a volume of its own from a thread, while the other threads fill
+ * theirs, and returns the number of errors (the volume is passed as argument).
+ */
+void *thread_volume(void *arg)
+{
+  sfs_context *volume = arg;
+  long errors = 0;
+  char buffer[5000];
+  char name[MAX_FILENAME];
+  int fd, i, j;
+
+  for (i = 0; i < 50; i++) {
+    sprintf(name, "V%d.DAT", i);
+    for (j = 0; j < sizeof(buffer); j++) {
+      buffer[j] = i + j % 13;
+    }
+    fd = sfs_ctx_fopen(volume, name);
+    if (fd < 0 || sfs_ctx_fwrite(volume, fd, buffer, 1000 + 80 * i) != 1000 + 80 * i) {
+      fprintf(stderr, "ERROR: writing %s to its volume failed\n", name);
+      errors++;
+    }
+    sfs_ctx_fclose(volume, fd);
+  }
+  return (void *)errors;
+}
+
+/* The main testing program
+ */
+int
+main(int argc, char **argv)
+{
+  printf("----------------------------------TEST 3----------------------------------\n");
+
+  int error_count = 0;
+  char name[MAX_FILENAME];
+  int i;
+  sfs_context *fs = sfs_default_context();
+
+  /* Geometry: an invalid geometry is refused.
+   */
+  if (sfs_format(1000, 100, 1000) != -1 || sfs_format(4096, 1, 1000) != -1 ||
+      sfs_format(4096, 100, 4) != -1) {
+    fprintf(stderr, "ERROR: an invalid geometry was accepted\n");
+    error_count++;
+  }
+
+  /* Geometry: a volume of few, large blocks for large files.
+   */
+  if (sfs_format(4096, 16, 2048) != 0) {
+    fprintf(stderr, "ERROR: formatting a 4096 byte block volume failed\n");
+    error_count++;
+  }
+  error_count += write_pattern("BULK.A", 3000000);
+  error_count += write_pattern("BULK.B", 100000);
+  for (i = 2; i < 16; i++) {
+    sprintf(name, "BULK.%c", 'A' + i);
+    if (i < 15 && sfs_fclose(sfs_fopen(name)) != 0) {
+      fprintf(stderr, "ERROR: creating %s failed\n", name);
+      error_count++;
+    }
+    if (i == 15 && sfs_fopen(name) != -1) {
+      fprintf(stderr, "ERROR: created more files than the volume holds\n");
+      error_count++;
+    }
+  }
+
+  /* The geometry is read back from the super block when mounting.
+   */
+  mksfs(0);
+  if (BLOCK_SIZE != 4096 || MAX_FILES != 16 || NUM_OF_BLOCKS != 2048) {
+    fprintf(stderr, "ERROR: mounted with geometry %d/%d/%d\n", BLOCK_SIZE, MAX_FILES, NUM_OF_BLOCKS);
+    error_count++;
+  }
+  error_count += check_pattern("BULK.A", 3000000);
+  error_count += check_pattern("BULK.B", 100000);
+
+  /* Geometry: a volume of many, small blocks for small files.
+   */
+  if (sfs_format(1024, 2000, 8192) != 0) {
+    fprintf(stderr, "ERROR: formatting a 1024 byte block volume failed\n");
+    error_count++;
+  }
+  for (i = 0; i < 1999; i++) {
+    sprintf(name, "%c%d.TXT", 'A' + i % 26, i);
+    error_count += write_pattern(name, 1 + i % 2000);
+  }
+  mksfs(0);
+  if (BLOCK_SIZE != 1024 || MAX_FILES != 2000 || NUM_OF_BLOCKS != 8192) {
+    fprintf(stderr, "ERROR: mounted with geometry %d/%d/%d\n", BLOCK_SIZE, MAX_FILES, NUM_OF_BLOCKS);
+    error_count++;
+  }
+  for (i = 0; i < 1999; i++) {
+    sprintf(name, "%c%d.TXT", 'A' + i % 26, i);
+    error_count += check_pattern(name, 1 + i % 2000);
+  }
+
+  /* Threads: every call may run concurrently with the others.
+   */
+  pthread_t threads[NUM_OF_THREADS];
+  void *errors;
+  sfs_format(1024, 500, 16384);
+  for (i = 0; i < NUM_OF_THREADS; i++) {
+    pthread_create(&threads[i], NULL, thread_files, (void *)(long)i);
+  }
+  for (i = 0; i < NUM_OF_THREADS; i++) {
+    pthread_join(threads[i], &errors);
+    error_count += (long)errors;
+  }
+  mksfs(0);
+  for (i = 0; i < NUM_OF_THREADS * 20; i++) {
+    sprintf(name, "%c%d.TMP", 'A' + i / 20, i % 20);
+    if (i % 2 == 0) {
+      error_count += check_pattern(name, 1000 + 3000 * (i % 20));
+    } else if (sfs_getfilesize(name) != -1) {
+      fprintf(stderr, "ERROR: removed file %s is still there\n", name);
+      error_count++;
+    }
+  }
+
+  /* Volumes: several images are mounted at once, each filled by its own thread.
+   */
+  sfs_context *volumes[4];
+  char buffer[5000];
+  int fd, j;
+  for (i = 0; i < 4; i++) {
+    sprintf(name, "volume.%d.sfs", i);
+    volumes[i] = sfs_mkfs(name, 1024, 100, 4096);
+    if (volumes[i] == NULL) {
+      fprintf(stderr, "ERROR: creating %s failed\n", name);
+      return ++error_count;
+    }
+    pthread_create(&threads[i], NULL, thread_volume, volumes[i]);
+  }
+  for (i = 0; i < 4; i++) {
+    pthread_join(threads[i], &errors);
+    error_count += (long)errors;
+    sfs_unmount(volumes[i]);
+  }
+  /* each volume holds its own files once mounted again */
+  for (i = 0; i < 4; i++) {
+    sprintf(name, "volume.%d.sfs", i);
+    volumes[i] = sfs_mount(name);
+    if (volumes[i] == NULL) {
+      fprintf(stderr, "ERROR: mounting %s failed\n", name);
+      return ++error_count;
+    }
+  }
+  for (i = 0; i < 50; i++) {
+    sprintf(name, "V%d.DAT", i);
+    for (j = 0; j < 4; j++) {
+      fd = sfs_ctx_fopen(volumes[j], name);
+      if (fd < 0 || sfs_ctx_getfilesize(volumes[j], name) != 1000 + 80 * i ||
+          sfs_ctx_fseek(volumes[j], fd, 0) != 0 ||
+          sfs_ctx_fread(volumes[j], fd, buffer, 1000 + 80 * i) != 1000 + 80 * i ||
+          buffer[999] != (char)(i + 999 % 13)) {
+        fprintf(stderr, "ERROR: %s is wrong on volume %d\n", name, j);
+        error_count++;
+      }
+      sfs_ctx_fclose(volumes[j], fd);
+    }
+  }
+  for (i = 0; i < 4; i++) {
+    sfs_unmount(volumes[i]);
+  }
+
+  /* Shards: the files of a set are spread across its volumes by name, and
+   * listed together.
+   */
+  sfs_shard_set *set = sfs_shards_open(4, 1);
+  if (set == NULL) {
+    fprintf(stderr, "ERROR: opening a set of 4 shards failed\n");
+    return ++error_count;
+  }
+  for (i = 0; i < 100; i++) {
+    sprintf(name, "S%d.DAT", i);
+    fd = sfs_shards_fopen(set, name);
+    if (fd < 0 || sfs_shards_fwrite(set, fd, name, strlen(name) + 1) != strlen(name) + 1) {
+      fprintf(stderr, "ERROR: writing %s to the set failed\n", name);
+      error_count++;
+    }
+    sfs_shards_fclose(set, fd);
+  }
+  for (i = 0; i < 100; i += 2) {
+    sprintf(name, "S%d.DAT", i);
+    if (sfs_shards_remove(set, name) != 0) {
+      fprintf(stderr, "ERROR: removing %s from the set failed\n", name);
+      error_count++;
+    }
+  }
+  sfs_shards_close(set);
+  set = sfs_shards_open(4, 0);
+  if (set == NULL) {
+    fprintf(stderr, "ERROR: mounting a set of 4 shards failed\n");
+    return ++error_count;
+  }
+  for (j = 0; sfs_shards_getnextfilename(set, name); j++) {
+    fd = sfs_shards_fopen(set, name);
+    if (fd < 0 || sfs_shards_fseek(set, fd, 0) != 0 ||
+        sfs_shards_fread(set, fd, buffer, strlen(name) + 1) != strlen(name) + 1 ||
+        strcmp(buffer, name) != 0 || sscanf(name, "S%d.DAT", &i) != 1 || i % 2 == 0) {
+      fprintf(stderr, "ERROR: %s is wrong on the set\n", name);
+      error_count++;
+    }
+    sfs_shards_fclose(set, fd);
+  }
+  if (j != 50) {
+    fprintf(stderr, "ERROR: listed %d files of the set instead of 50\n", j);
+    error_count++;
+  }
+  sfs_shards_close(set);
+
+  /* Positional I/O: the pointer of the descriptor is left alone, and a
+   * file written past its end reads as 0's in between.
+   */
+  char contents[6000];
+  fd = sfs_fopen("POSITION.TXT");
+  if (sfs_pwrite(fd, "tail", 5, 5000) != 5 || sfs_pwrite(fd, "head", 4, 0) != 4 ||
+      sfs_getfilesize("POSITION.TXT") != 5005) {
+    fprintf(stderr, "ERROR: positional writes failed\n");
+    error_count++;
+  }
+  memset(contents, 1, sizeof(contents));
+  if (sfs_pread(fd, contents, sizeof(contents), 0) != 5005 || memcmp(contents, "head", 4) != 0 ||
+      contents[4] != 0 || contents[4999] != 0 || strcmp(contents + 5000, "tail") != 0 ||
+      sfs_pread(fd, contents, 10, 5005) != 0) {
+    fprintf(stderr, "ERROR: positional reads failed\n");
+    error_count++;
+  }
+  /* the pointer is still at the start */
+  if (sfs_fread(fd, contents, 4) != 4 || memcmp(contents, "head", 4) != 0) {
+    fprintf(stderr, "ERROR: positional I/O moved the pointer\n");
+    error_count++;
+  }
+  sfs_fclose(fd);
+
+  /* Open files: a file can be opened several times, each descriptor has its
+   * own pointer, and the file can only be removed once all of them are closed.
+   */
+  int fds[3];
+  error_count += write_pattern("SHARED.TXT", 3000);
+  for (i = 0; i < 3; i++) {
+    fds[i] = sfs_fopen("SHARED.TXT");
+    sfs_fseek(fds[i], 1000 * i);
+  }
+  if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 || fds[0] == fds[1] || fds[1] == fds[2] || fds[0] == fds[2]) {
+    fprintf(stderr, "ERROR: opening SHARED.TXT three times failed\n");
+    error_count++;
+  }
+  for (i = 0; i < 3; i++) {
+    if (sfs_fread(fds[i], contents, 10) != 10 || contents[9] != (char)('S' + (1000 * i + 9) % 251)) {
+      fprintf(stderr, "ERROR: descriptor %d of SHARED.TXT read at the wrong position\n", i);
+      error_count++;
+    }
+  }
+  /* what is written through a descriptor is read through the others */
+  if (sfs_fwrite(fds[0], "shared", 6) != 6 || sfs_pread(fds[2], contents, 6, 10) != 6 ||
+      memcmp(contents, "shared", 6) != 0) {
+    fprintf(stderr, "ERROR: a write to SHARED.TXT was not seen by its other descriptors\n");
+    error_count++;
+  }
+  for (i = 0; i < 3; i++) {
+    if (sfs_remove("SHARED.TXT") != -1) {
+      fprintf(stderr, "ERROR: SHARED.TXT was removed while open\n");
+      error_count++;
+    }
+    sfs_fclose(fds[i]);
+  }
+  if (sfs_remove("SHARED.TXT") != 0) {
+    fprintf(stderr, "ERROR: removing SHARED.TXT once closed failed\n");
+    error_count++;
+  }
+
+  /* many readers stream the same file at once */
+  error_count += write_pattern("HOT.TXT", 50000);
+  for (i = 0; i < NUM_OF_THREADS; i++) {
+    pthread_create(&threads[i], NULL, thread_reader, NULL);
+  }
+  for (i = 0; i < NUM_OF_THREADS; i++) {
+    pthread_join(threads[i], &errors);
+    error_count += (long)errors;
+  }
+  if (sfs_remove("HOT.TXT") != 0) {
+    fprintf(stderr, "ERROR: HOT.TXT was left open by its readers\n");
+    error_count++;
+  }
+
+  /* Vectors: the fragments are written one after the other in one call, and
+   * read back into buffers cut differently.
+   */
+  char record[3000], head[7], middle[2500], tail[1000];
+  struct iovec in[4] = { { "header", 6 }, { record, sizeof(record) }, { NULL, 0 }, { "trailer", 7 } };
+  struct iovec out[3] = { { head, sizeof(head) }, { middle, sizeof(middle) }, { tail, sizeof(tail) } };
+  for (i = 0; i < sizeof(record); i++) {
+    record[i] = 'A' + i % 26;
+  }
+  fd = sfs_fopen("VECTOR.TXT");
+  if (sfs_fwritev(fd, in, 4) != 3013 || sfs_getfilesize("VECTOR.TXT") != 3013) {
+    fprintf(stderr, "ERROR: vector write failed\n");
+    error_count++;
+  }
+  sfs_fseek(fd, 0);
+  if (sfs_freadv(fd, out, 3) != 3013 || memcmp(head, "headerA", 7) != 0 ||
+      memcmp(middle, record + 1, sizeof(middle)) != 0 || memcmp(tail, record + 2501, 499) != 0 ||
+      memcmp(tail + 499, "trailer", 7) != 0) {
+    fprintf(stderr, "ERROR: vector read failed\n");
+    error_count++;
+  }
+  /* the positional variants leave the pointer alone, and fill the gaps with 0's */
+  if (sfs_pwritev(fd, in + 3, 1, 4000) != 7 || sfs_getfilesize("VECTOR.TXT") != 4007 ||
+      sfs_preadv(fd, out, 1, 3999) != 7 || memcmp(head, "\0traile", 7) != 0 ||
+      sfs_pwritev(fd, in, -1, 0) != -1) {
+    fprintf(stderr, "ERROR: positional vector I/O failed\n");
+    error_count++;
+  }
+  sfs_fclose(fd);
+
+  /* Listing: a directory listed in small batches, while files are created and
+   * removed, gives every file that stays exactly once, with its i-Node and size.
+   */
+  readdir_entry listing[4];
+  int seen[40], removed[40];
+  int cookie, count, batch, k;
+  sfs_format(1024, 100, 2048);
+  for (i = 0; i < 30; i++) {
+    sprintf(name, "L%d.TXT", i);
+    error_count += write_pattern(name, 10 * i + 1);
+  }
+  memset(seen, 0, sizeof(seen));
+  memset(removed, 0, sizeof(removed));
+  for (cookie = 1, batch = 0; (count = sfs_readdir(cookie, listing, 4)) > 0; batch++) {
+    for (j = 0; j < count; j++) {
+      if (sscanf(listing[j].filename, "L%d", &k) != 1 || k < 0 || k >= 40 ||
+          listing[j].i_node_number != sfs_lookup(listing[j].filename) ||
+          listing[j].size != sfs_getfilesize(listing[j].filename)) {
+        fprintf(stderr, "ERROR: wrong listing entry %s\n", listing[j].filename);
+        error_count++;
+        continue;
+      }
+      seen[k]++;
+    }
+    cookie = listing[count - 1].i_node_number + 1;
+    /* a file not listed yet goes away, and a new one comes */
+    if (batch < 5) {
+      sprintf(name, "L%d.TXT", 29 - batch);
+      sfs_remove(name);
+      removed[29 - batch] = 1;
+      sprintf(name, "L%d.TXT", 30 + batch);
+      error_count += write_pattern(name, 5);
+    }
+  }
+  for (k = 0; k < 40; k++) {
+    if ((k < 30 && !removed[k] && seen[k] != 1) || (removed[k] && seen[k] != 0) || seen[k] > 1) {
+      fprintf(stderr, "ERROR: L%d.TXT was listed %d times\n", k, seen[k]);
+      error_count++;
+    }
+  }
+
+  /* Extents: a file written over a fragmented disk has more extents than its
+   * i-Node holds, they go to leaf blocks listed by an index block.
+   */
+  char block[512];
+  int num_of_fillers, frag_size, frag_extents;
+  sfs_format(512, 4000, 2048);
+  /* fill the disk with one block files, then free every other one */
+  for (num_of_fillers = 0; ; num_of_fillers++) {
+    sprintf(name, "F%d.BLK", num_of_fillers);
+    memset(block, num_of_fillers, sizeof(block));
+    fd = sfs_fopen(name);
+    if (fd < 0) {
+      break;
+    }
+    j = sfs_fwrite(fd, block, sizeof(block));
+    sfs_fclose(fd);
+    if (j != sizeof(block)) {
+      sfs_remove(name);
+      break;
+    }
+  }
+  for (i = 0; i < num_of_fillers; i += 2) {
+    sprintf(name, "F%d.BLK", i);
+    sfs_remove(name);
+  }
+  /* the file takes most of the holes, along with its leaf and index blocks */
+  frag_size = (num_of_fillers / 2 - 16) * BLOCK_SIZE;
+  error_count += write_pattern("FRAG.DAT", frag_size);
+  frag_extents = fs->i_node_table.i_nodes[sfs_lookup("FRAG.DAT")].num_of_extents;
+  if (frag_extents <= 2 * EXTENTS_PER_LEAF) {
+    fprintf(stderr, "ERROR: FRAG.DAT has %d extents, the disk is not fragmented\n", frag_extents);
+    error_count++;
+  }
+  /* the extents are read back from the leaf blocks once mounted again */
+  mksfs(0);
+  error_count += check_pattern("FRAG.DAT", frag_size);
+  if (fs->i_node_table.i_nodes[sfs_lookup("FRAG.DAT")].num_of_extents != frag_extents) {
+    fprintf(stderr, "ERROR: FRAG.DAT lost extents when mounting\n");
+    error_count++;
+  }
+  for (i = 1; i < num_of_fillers; i += 2) {
+    sprintf(name, "F%d.BLK", i);
+    memset(block, 0, sizeof(block));
+    fd = sfs_fopen(name);
+    sfs_fseek(fd, 0);
+    if (sfs_fread(fd, block, sizeof(block)) != sizeof(block) || block[0] != (char)i || block[511] != (char)i) {
+      fprintf(stderr, "ERROR: %s was overwritten\n", name);
+      error_count++;
+    }
+    sfs_fclose(fd);
+  }
+
+  /* Truncation: the blocks past the new end go back to the disk, along with the
+   * leaf and index blocks that no longer hold extents, and a file that grows
+   * back reads as 0's past its old end.
+   */
+  int trunc_size = frag_size / 3 + 100, trunc_blocks, trunc_extents;
+  fds[0] = sfs_fopen("FRAG.DAT");
+  fds[1] = sfs_fopen("FRAG.DAT");
+  /* into the middle of a block, dropping leaf blocks */
+  if (sfs_ftruncate(fds[0], trunc_size) != 0 || sfs_getfilesize("FRAG.DAT") != trunc_size ||
+      fs->i_node_table.i_nodes[sfs_lookup("FRAG.DAT")].num_of_extents >= frag_extents) {
+    fprintf(stderr, "ERROR: truncating FRAG.DAT to %d bytes failed\n", trunc_size);
+    error_count++;
+  }
+  /* the other descriptor, left at the old end, now writes at the new one */
+  if (sfs_fwrite(fds[1], "Z", 1) != 1 || sfs_getfilesize("FRAG.DAT") != trunc_size + 1 ||
+      sfs_ftruncate(fds[1], trunc_size) != 0) {
+    fprintf(stderr, "ERROR: truncating FRAG.DAT left a pointer past its end\n");
+    error_count++;
+  }
+  sfs_fclose(fds[1]);
+  error_count += check_pattern("FRAG.DAT", trunc_size);
+  /* down to a few blocks (the extents fit in the i-Node again), then back up */
+  if (sfs_ftruncate(fds[0], 2 * BLOCK_SIZE + 7) != 0 || sfs_ftruncate(fds[0], 4000) != 0 ||
+      sfs_getfilesize("FRAG.DAT") != 4000) {
+    fprintf(stderr, "ERROR: truncating FRAG.DAT down and back up failed\n");
+    error_count++;
+  }
+  sfs_fclose(fds[0]);
+  /* once mounted again, the content is kept and only the blocks in use are allocated */
+  mksfs(0);
+  fd = sfs_fopen("FRAG.DAT");
+  memset(contents, 1, sizeof(contents));
+  if (sfs_pread(fd, contents, 4000, 0) != 4000 || contents[2 * BLOCK_SIZE + 6] != (char)('F' + (2 * BLOCK_SIZE + 6) % 251)) {
+    fprintf(stderr, "ERROR: FRAG.DAT lost its content when truncated\n");
+    error_count++;
+  }
+  for (i = 2 * BLOCK_SIZE + 7; i < 4000 && contents[i] == 0; i++);
+  if (i < 4000) {
+    fprintf(stderr, "ERROR: FRAG.DAT does not read as 0's at position %d past its old end\n", i);
+    error_count++;
+  }
+  sfs_fclose(fd);
+  trunc_extents = fs->i_node_table.i_nodes[sfs_lookup("FRAG.DAT")].num_of_extents;
+  trunc_blocks = CEILING(4000, BLOCK_SIZE) +
+      (trunc_extents > NUM_OF_INLINE_EXTENTS ? 1 + CEILING(trunc_extents, EXTENTS_PER_LEAF) : 0);
+  if (fs->bit_map.size != DATA_BLOCKS_ADDRESS + num_of_fillers / 2 + trunc_blocks) {
+    fprintf(stderr, "ERROR: %d blocks are allocated instead of %d\n", fs->bit_map.size,
+            DATA_BLOCKS_ADDRESS + num_of_fillers / 2 + trunc_blocks);
+    error_count++;
+  }
+
+  /* Journal: a transaction that committed to the journal, but was cut short
+   * before reaching its place on the disk, is written in place again when
+   * mounting, and a transaction whose checksum does not match is ignored.
+   */
+  sfs_format(1024, 100, 2048);
+  int table_blocks = JOURNAL_ADDRESS - I_NODE_TABLE_ADDRESS, journal_blocks;
+  char *tables = malloc((long)table_blocks * BLOCK_SIZE);
+  char *journal = malloc((long)JOURNAL_BLOCKS * BLOCK_SIZE);
+  error_count += write_pattern("OLD.TXT", 3000);
+  journal_commit(fs);
+  read_blocks(&fs->disk, I_NODE_TABLE_ADDRESS, table_blocks, tables);
+  error_count += write_pattern("NEW.TXT", 3000);
+  journal_commit(fs);
+  /* the tables on the disk go back to what they were before the last transaction */
+  read_blocks(&fs->disk, JOURNAL_ADDRESS, JOURNAL_BLOCKS, journal);
+  journal_blocks = JOURNAL_DESCRIPTOR_BLOCKS + ((journal_header *)journal)->num_of_blocks;
+  write_blocks(&fs->disk, I_NODE_TABLE_ADDRESS, table_blocks, tables);
+  mksfs(0);
+  error_count += check_pattern("OLD.TXT", 3000);
+  error_count += check_pattern("NEW.TXT", 3000);
+  read_blocks(&fs->disk, JOURNAL_ADDRESS, 1, contents);
+  if (((journal_header *)contents)->num_of_blocks != 0) {
+    fprintf(stderr, "ERROR: the journal is not empty once replayed\n");
+    error_count++;
+  }
+  /* the same transaction, with a block damaged */
+  journal_commit(fs);
+  journal[(long)(journal_blocks - 1) * BLOCK_SIZE] ^= 1;
+  write_blocks(&fs->disk, JOURNAL_ADDRESS, journal_blocks, journal);
+  write_blocks(&fs->disk, I_NODE_TABLE_ADDRESS, table_blocks, tables);
+  mksfs(0);
+  error_count += check_pattern("OLD.TXT", 3000);
+  if (sfs_lookup("NEW.TXT") != -1) {
+    fprintf(stderr, "ERROR: a transaction with a bad checksum was replayed\n");
+    error_count++;
+  }
+  free(tables);
+  free(journal);
+
+  /* Full disk: a write or a truncation past the end of a file that the disk
+   * can not hold fails without growing the file or keeping any block.
+   */
+  int used_blocks;
+  sfs_format(1024, 100, 2048);
+  error_count += write_pattern("GAP.DAT", 3000);
+  fd = sfs_fopen("GAP.DAT");
+  fds[0] = sfs_fopen("FILL.DAT");
+  memset(contents, 'f', sizeof(contents));
+  while (sfs_fwrite(fds[0], contents, BLOCK_SIZE) == BLOCK_SIZE);
+  sfs_ftruncate(fds[0], sfs_getfilesize("FILL.DAT") - 100 * BLOCK_SIZE);
+  sfs_sync();
+  used_blocks = fs->bit_map.size;
+  if (sfs_pwrite(fd, "ab", 2, 500 * BLOCK_SIZE) > 0 || sfs_getfilesize("GAP.DAT") != 3000 ||
+      fs->bit_map.size != used_blocks) {
+    fprintf(stderr, "ERROR: a write past the end of a full disk changed the file\n");
+    error_count++;
+  }
+  if (sfs_ftruncate(fd, 500 * BLOCK_SIZE) != -1 || sfs_getfilesize("GAP.DAT") != 3000 ||
+      fs->bit_map.size != used_blocks) {
+    fprintf(stderr, "ERROR: growing GAP.DAT past what the disk holds changed the file\n");
+    error_count++;
+  }
+  /* the gap the disk can hold is still filled */
+  if (sfs_pwrite(fd, "ab", 2, 50 * BLOCK_SIZE) != 2 || sfs_getfilesize("GAP.DAT") != 50 * BLOCK_SIZE + 2) {
+    fprintf(stderr, "ERROR: writing past the end of GAP.DAT failed\n");
+    error_count++;
+  }
+  sfs_fclose(fd);
+  sfs_fclose(fds[0]);
+
+  /* Mapping: a write mapped by sfs_fmap grows the file by what was copied
+   * in, and sfs_fmap_done refuses a write that was not mapped.
+   */
+  file_extent extents[4];
+  sfs_format(1024, 100, 2048);
+  error_count += write_pattern("MAP.DAT", 3000);
+  fd = sfs_fopen("MAP.DAT");
+  if (sfs_fmap_done(fd, 0, 0) != -1) {
+    fprintf(stderr, "ERROR: sfs_fmap_done finished a write that was not mapped\n");
+    error_count++;
+  }
+  /* nothing copied in: the gap goes too */
+  if (sfs_fmap(fd, 5000, 10, 1, extents, 4) != 1 || sfs_fmap_done(fd, 5000, 0) != 0 ||
+      sfs_getfilesize("MAP.DAT") != 3000) {
+    fprintf(stderr, "ERROR: a mapped write with nothing copied in changed MAP.DAT\n");
+    error_count++;
+  }
+  /* at most the mapped bytes count, and the write is only finished once */
+  if (sfs_fmap(fd, 3000, 5, 1, extents, 4) != 1 ||
+      pwrite(disk_fd(&fs->disk), "hello", 5, extents[0].disk_offset) != 5 ||
+      sfs_fmap_done(fd, 2000, 5) != -1 || sfs_fmap_done(fd, 3000, 100) != 0 ||
+      sfs_fmap_done(fd, 3000, 5) != -1 || sfs_getfilesize("MAP.DAT") != 3005) {
+    fprintf(stderr, "ERROR: finishing a mapped write of MAP.DAT failed\n");
+    error_count++;
+  }
+  if (sfs_pread(fd, contents, 5, 3000) != 5 || memcmp(contents, "hello", 5) != 0) {
+    fprintf(stderr, "ERROR: MAP.DAT does not read back what was copied in\n");
+    error_count++;
+  }
+  /* a mapped read keeps the blocks a truncation gives back until it is released */
+  fds[0] = sfs_fopen("MAP.DAT");
+  if (sfs_fmap(fd, 0, 100, 0, extents, 4) != 1 || sfs_ftruncate(fds[0], 0) != 0 || sfs_sync() != 0 ||
+      pread(disk_fd(&fs->disk), contents, 100, extents[0].disk_offset) != 100 || contents[99] != (char)('M' + 99)) {
+    fprintf(stderr, "ERROR: the blocks of a mapped read were discarded\n");
+    error_count++;
+  }
+  sfs_fmap_release();
+  sfs_sync();
+  if (fs->journal.num_of_pending_frees != 0) {
+    fprintf(stderr, "ERROR: the blocks of a released read are still pending\n");
+    error_count++;
+  }
+  sfs_fclose(fds[0]);
+  if (sfs_fclose(fd) != 0) {
+    fprintf(stderr, "ERROR: closing MAP.DAT failed\n");
+    error_count++;
+  }
+
+  /* Committer: the changes of an idle volume are committed once the commit
+   * interval is over, with no call made meanwhile.
+   */
+  sfs_format(1024, 100, 2048);
+  error_count += write_pattern("IDLE.DAT", 3000);
+  pthread_rwlock_rdlock(&fs->transaction_lock);
+  int sequence = fs->journal.sequence;
+  pthread_rwlock_unlock(&fs->transaction_lock);
+  sleep(COMMIT_INTERVAL / 1000 + 1);
+  pthread_rwlock_rdlock(&fs->transaction_lock);
+  int committed = fs->journal.sequence != sequence;
+  pthread_rwlock_unlock(&fs->transaction_lock);
+  if (!committed) {
+    fprintf(stderr, "ERROR: the changes of an idle volume were not committed\n");
+    error_count++;
+  }
+
+  fprintf(stderr, "Test program exiting with %d errors\n", error_count);
+  return (error_count);
+}